@@ -37,6 +37,8 @@ Axis::Axis(QWidget *parent) :
   connect(ui->points, SIGNAL(valueEdited(int)), SIGNAL(pointsChanged(int)));
 
   connect(ui->mode, SIGNAL(activated(QString)), this, SIGNAL(settingChanged()));
+  connect(ui->fly, SIGNAL(toggled(bool)), this, SIGNAL(settingChanged()));
+  connect(ui->flyTime, SIGNAL(valueChanged(double)), this, SIGNAL(settingChanged()));
 
   setConnected(false);
   positionsAcceptable();
@@ -144,6 +146,22 @@ void Axis::setMode(const QString & mod) {
   ui->mode->setCurrentIndex( ui->mode->findText(mod) );
 }
 
+void Axis::setFly(bool val) {
+  ui->fly->setChecked(val);
+}
+
+void Axis::setFlyTime(double val) {
+  ui->flyTime->setValue(val);
+}
+
+void Axis::setFlyAvailable(bool avail) {
+  if ( ! avail )
+    ui->fly->setChecked(false);
+  ui->fly->setVisible(avail);
+  ui->flyTime->setVisible(avail);
+  ui->label_39->setVisible(avail);
+}
+
 
 void Axis::pointsCh(int val){
   ui->step->setValue( ( ui->end->value() - ui->start->value() ) / (val-1) );
@@ -31,6 +31,8 @@ public:
   inline double end() { return ui->end->value(); }
   inline Mode mode() { return (Mode) ui->mode->currentIndex(); }
   inline QString modeString() { return ui->mode->currentText(); }
+  inline bool fly() { return ui->fly->isChecked(); }
+  inline double flyTime() { return ui->flyTime->value(); }
 
   bool isReady();
 
@@ -47,6 +49,9 @@ public slots:
   void setEnd(double val);
   void setMode(const QString & mod);
   void setPointsEnabled(bool enab);
+  void setFly(bool val);
+  void setFlyTime(double val);
+  void setFlyAvailable(bool avail);
 
 
 private slots:
@@ -0,0 +1,106 @@
+#include "binaryscan.h"
+#include <string.h>
+
+
+const char BinaryScan::magic[8] = { 'S', 'c', 'a', 'n', 'M', 'X', 'b', '\n' };
+const quint32 BinaryScan::byteOrder = 0x01020304;
+const quint32 BinaryScan::version = 1;
+
+/// Fixed header: magic, byte order, version, number of columns, sizes of
+/// the metadata and of the column names, reserved, offset of the rows.
+static const int fixedSize = 8 + 6 * sizeof(quint32) + sizeof(quint64);
+
+
+QByteArray BinaryScan::header(const QString & metadata, const QStringList & columns) {
+
+  const QByteArray metaBytes = metadata.toUtf8();
+  const QByteArray namesBytes = columns.join("\n").toUtf8();
+  quint64 dataOffset = fixedSize + metaBytes.size() + namesBytes.size();
+  dataOffset += ( sizeof(double) - dataOffset % sizeof(double) ) % sizeof(double);
+
+  const quint32 fields[6] = { byteOrder, version, quint32(columns.size()),
+                              quint32(metaBytes.size()), quint32(namesBytes.size()), 0 };
+  QByteArray head(dataOffset, '\0');
+  char * ptr = head.data();
+  memcpy(ptr, magic, sizeof(magic));
+  memcpy(ptr + sizeof(magic), fields, sizeof(fields));
+  memcpy(ptr + sizeof(magic) + sizeof(fields), &dataOffset, sizeof(dataOffset));
+  memcpy(ptr + fixedSize, metaBytes.constData(), metaBytes.size());
+  memcpy(ptr + fixedSize + metaBytes.size(), namesBytes.constData(), namesBytes.size());
+  return head;
+
+}
+
+
+BinaryScan::BinaryScan(const QString & fileName)
+  : file(fileName)
+  , map(0)
+  , data(0)
+  , offset(0)
+  , nrows(0)
+{
+}
+
+
+BinaryScan::~BinaryScan() {
+  close();
+}
+
+
+void BinaryScan::close() {
+  if (map)
+    file.unmap(map);
+  map = 0;
+  data = 0;
+  nrows = 0;
+  file.close();
+}
+
+
+bool BinaryScan::fail(const QString & problem) {
+  error = problem;
+  close();
+  return false;
+}
+
+
+bool BinaryScan::open() {
+
+  close();
+  error.clear();
+  if ( ! file.open(QIODevice::ReadOnly) )
+    return fail(file.errorString());
+  const qint64 size = file.size();
+  if ( size < fixedSize )
+    return fail("Too short for the binary scan.");
+  map = file.map(0, size);
+  if ( ! map )
+    return fail(file.errorString());
+
+  quint32 fields[6];
+  quint64 dataOffset;
+  memcpy(fields, map + sizeof(magic), sizeof(fields));
+  memcpy(&dataOffset, map + sizeof(magic) + sizeof(fields), sizeof(dataOffset));
+  if ( memcmp(map, magic, sizeof(magic)) )
+    return fail("Not a binary scan.");
+  if ( fields[0] != byteOrder )
+    return fail("Written with another byte order.");
+  if ( fields[1] > version )
+    return fail("Unknown version " + QString::number(fields[1]) + ".");
+  const qint64 textEnd = qint64(fixedSize) + fields[3] + fields[4];
+  if ( ! fields[2]  ||  textEnd > size  ||  qint64(dataOffset) < textEnd
+       ||  qint64(dataOffset) > size  ||  dataOffset % sizeof(double) )
+    return fail("Corrupt header.");
+
+  const char * text = reinterpret_cast<const char *>(map) + fixedSize;
+  meta = QString::fromUtf8(text, fields[3]);
+  names = QString::fromUtf8(text + fields[3], fields[4]).split('\n');
+  if ( names.size() != int(fields[2]) )
+    return fail("Corrupt column names.");
+
+  offset = dataOffset;
+  data = reinterpret_cast<const double *>(map + offset);
+  nrows = ( size - offset ) / rowBytes(); // the incomplete last row is left out
+  return true;
+
+}
@@ -0,0 +1,63 @@
+#ifndef BINARYSCAN_H
+#define BINARYSCAN_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+
+/// Binary data file of the scan, read through the memory map.
+///
+/// The file starts with the fixed header, followed by the metadata (the
+/// same text as the header of the text data file), the column names (one
+/// per line) and zeros up to the 8-byte boundary. Then come the rows: one
+/// native double per column, NaN where the signal is not a number. There
+/// is no row count: the scan appends the rows as they come and the reader
+/// takes all the complete ones.
+class BinaryScan {
+
+public:
+
+  static const char magic[8];
+  static const quint32 byteOrder; ///< as written by the machine of the scan
+  static const quint32 version;
+
+  /// The part of the file before the rows.
+  static QByteArray header(const QString & metadata, const QStringList & columns);
+
+  explicit BinaryScan(const QString & fileName);
+  ~BinaryScan();
+
+  /// Maps the file; again to see the rows appended since.
+  bool open();
+  void close();
+  inline const QString & errorString() const { return error; }
+
+  inline const QString & metadata() const { return meta; }
+  inline const QStringList & columns() const { return names; }
+  inline int rows() const { return nrows; }
+  inline qint64 dataOffset() const { return offset; }
+  inline qint64 rowBytes() const { return sizeof(double) * names.size(); }
+
+  /// Directly in the map: valid until close() or open().
+  inline const double * row(int r) const { return data + r * names.size(); }
+  inline double value(int r, int c) const { return row(r)[c]; }
+
+private:
+
+  QFile file;
+  uchar * map;
+  const double * data;
+  QString error;
+  QString meta;
+  QStringList names;
+  qint64 offset;
+  int nrows;
+
+  bool fail(const QString & problem);
+
+};
+
+
+#endif // BINARYSCAN_H
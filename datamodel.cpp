@@ -0,0 +1,72 @@
+#include "datamodel.h"
+
+
+DataModel::DataModel(ScanData * _store, QObject * parent)
+  : QAbstractTableModel(parent)
+  , store(_store)
+{
+}
+
+
+void DataModel::reset(const QStringList & _headers) {
+  beginResetModel();
+  headers = _headers;
+  store->reset(headers.size());
+  endResetModel();
+}
+
+
+void DataModel::setHeader(int col, const QString & name) {
+  if ( col < 0  ||  col >= headers.size()  ||  headers[col] == name )
+    return;
+  headers[col] = name;
+  emit headerDataChanged(Qt::Horizontal, col, col);
+}
+
+
+void DataModel::grow(int rows) {
+  if ( rows <= store->rows() )
+    return;
+  beginInsertRows(QModelIndex(), store->rows(), rows - 1);
+  store->grow(rows);
+  endInsertRows();
+}
+
+
+void DataModel::rowChanged(int row) {
+  if ( row >= 0  &&  row < store->rows()  &&  ! headers.isEmpty() )
+    emit dataChanged(index(row, 0), index(row, headers.size() - 1));
+}
+
+
+int DataModel::rowCount(const QModelIndex & parent) const {
+  return parent.isValid() ? 0 : store->rows();
+}
+
+
+int DataModel::columnCount(const QModelIndex & parent) const {
+  return parent.isValid() ? 0 : headers.size();
+}
+
+
+QVariant DataModel::data(const QModelIndex & index, int role) const {
+  if ( ! index.isValid() )
+    return QVariant();
+  const int row = index.row();
+  const int col = index.column();
+  if ( role == Qt::DisplayRole )
+    return store->text(row, col);
+  if ( role == Qt::ToolTipRole  &&  store->hasErrors(col)  &&  store->isSet(row, col) )
+    return "std " + QString::number(store->error(row, col))
+        + ", " + QString::number(store->count(row)) + " exposures";
+  return QVariant();
+}
+
+
+QVariant DataModel::headerData(int section, Qt::Orientation orientation, int role) const {
+  if ( role != Qt::DisplayRole )
+    return QVariant();
+  if ( orientation == Qt::Vertical )
+    return section + 1;
+  return headers.value(section);
+}
@@ -0,0 +1,43 @@
+#ifndef DATAMODEL_H
+#define DATAMODEL_H
+
+#include <QAbstractTableModel>
+#include <QStringList>
+#include "scandata.h"
+
+
+/// Table view of the ScanData.
+///
+/// The text of a cell is formatted only when the view asks for it, so only
+/// the visible cells cost anything. The values are set directly in the
+/// ScanData; the rows are added through the model to notify the views.
+class DataModel : public QAbstractTableModel {
+  Q_OBJECT;
+
+public:
+
+  explicit DataModel(ScanData * store, QObject * parent = 0);
+
+  /// Drops all the data and sets the columns.
+  void reset(const QStringList & headers);
+  void setHeader(int col, const QString & name);
+
+  /// Appends empty rows up to _rows_.
+  void grow(int rows);
+  /// Notifies the views once all cells of the _row_ are set.
+  void rowChanged(int row);
+
+  int rowCount(const QModelIndex & parent = QModelIndex()) const;
+  int columnCount(const QModelIndex & parent = QModelIndex()) const;
+  QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const;
+  QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+private:
+
+  ScanData * store;
+  QStringList headers;
+
+};
+
+
+#endif // DATAMODEL_H
@@ -11,7 +11,9 @@
 #include <qwt_plot_grid.h>
 #include <qwt_color_map.h>
 #include <qwt_picker_machine.h>
-#include <qwt_matrix_raster_data.h>
+#include <qwt_series_data.h>
+#include <qwt_clipper.h>
+#include <qwt_painter.h>
 
 #if QWT_VERSION >= 0x060100
 #include <qwt_point_data.h>
@@ -22,6 +24,9 @@
 #include "ui_graph.h"
 #include "error.h"
 
+#include <algorithm>
+#include <functional>
+
 
 QwtText MyPicker::trackerTextF(const QPointF &pos) const {
   latestPos = pos;
@@ -64,22 +69,35 @@ bool MyPicker::eventFilter(QObject * object, QEvent *event) {
 
 
 
+/// Plotted part of a column of the ScanData: _size_ rows from _offset_.
+/// The range and the filled part are kept up to date point by point.
 class PlotData {
 protected:
 
   double _min;
   double _max;
-  double * _data;
-  double _size;
+  const ScanData * _store;
+  int _column;
+  int _offset;
+  size_t _size;
+  size_t _filled;       ///< points up to the last one set
+  QVector<double> _own; ///< once refined the line keeps its own values
 
-  PlotData() : _min(NAN), _max(NAN), _data(0), _size(0) {}
+  PlotData(const ScanData * store, int column, size_t size)
+    : _min(NAN), _max(NAN), _store(store), _column(column), _offset(0), _size(size), _filled(0) {}
 
 public:
 
   double min() const {return _min;}
   double max() const {return _max;}
-  double * data() const {return _data;}
   size_t size() const {return _size;}
+  size_t filled() const {return _filled;}
+
+  inline double at(int idx) const {
+    return _own.isEmpty()  ?  _store->value(_offset + idx, _column)  :  _own[idx];
+  }
+
+  void setOffset(int offset) { _offset = offset; }
 
   QwtInterval interval() const {
     QwtInterval nint(_min,_max);
@@ -100,9 +118,11 @@ public:
   virtual void updateData() {
     _min = NAN;
     _max = NAN;
-    for (int idx=0 ; idx<_size ; idx++) {
-      double point = *(_data+idx);
+    _filled = 0;
+    for (size_t idx=0 ; idx<_size ; idx++) {
+      double point = at(idx);
       if ( ! isnan(point) ) {
+        _filled = idx + 1;
         if ( isnan(_min) || point < _min) _min = point;
         if ( isnan(_max) || point > _max) _max = point;
       }
@@ -110,7 +130,10 @@ public:
   }
 
 
-  virtual bool updateData(double point) {
+  /// The point _idx_ was set to _point_. Returns true if the range changed.
+  virtual bool updateData(size_t idx, double point) {
+    if ( idx < _size  &&  idx >= _filled )
+      _filled = idx + 1;
     if ( isnan(point) )
       return false;
     bool newRange = false;
@@ -129,20 +152,133 @@ public:
 
 
 
+/// Curve samples read from the PlotData: no copy of the values.
+/// Only the filled part of the line is drawn.
+class LineSeries : public QwtSeriesData<QPointF> {
+public:
+
+  const PlotData * pdata;
+  QVector<double> xData;
+  QRectF bounds;
+
+  LineSeries(const PlotData * _pdata, const QVector<double> & _xData)
+    : pdata(_pdata), xData(_xData) {}
+
+  size_t size() const { return qMin<size_t>(pdata->filled(), xData.size()); }
+  QPointF sample(size_t i) const { return QPointF(xData[i], pdata->at(i)); }
+  QRectF boundingRect() const { return bounds; }
+
+};
 
 
 
 class PlotLine : public QwtPlotCurve, public PlotData {
 private:
-  QwtPointArrayData * arrayData;
+  LineSeries * series;
+
+  void updateBounds() {
+    if ( series->xData.isEmpty() )
+      return;
+    const double xStart = series->xData.front();
+    const double xEnd = series->xData.back();
+    series->bounds = QRectF( qMin(xStart, xEnd), min(),
+                             qAbs(xEnd - xStart), max() - min() );
+  }
+
+  /// Indexes of the points in the visible x range of _xMap_ and one beyond each side.
+  void visibleRange(const QwtScaleMap & xMap, int & from, int & to) const {
+    const QVector<double> & xData = series->xData;
+    const double sMin = qMin(xMap.s1(), xMap.s2());
+    const double sMax = qMax(xMap.s1(), xMap.s2());
+    QVector<double>::const_iterator begin = xData.constBegin();
+    QVector<double>::const_iterator end = begin + to + 1;
+    int first, last;
+    if ( xData.front() <= xData.back() ) {
+      first = std::lower_bound(begin, end, sMin) - begin - 1;
+      last = std::upper_bound(begin, end, sMax) - begin;
+    } else {
+      first = std::lower_bound(begin, end, sMax, std::greater<double>()) - begin - 1;
+      last = std::upper_bound(begin, end, sMin, std::greater<double>()) - begin;
+    }
+    from = qMax(from, first);
+    to = qMin(to, last);
+  }
+
+  /// Adds the points of one pixel column: first, lowest, highest and last.
+  static void addColumn(QPolygonF & polyline, double px, const double col[4],
+                        const QwtScaleMap & yMap) {
+    polyline << QPointF(px, yMap.transform(col[0]));
+    double last = col[0];
+    if ( col[1] != col[0]  ||  col[2] != col[0] ) {
+      polyline << QPointF(px, yMap.transform(col[1]))
+               << QPointF(px, yMap.transform(col[2]));
+      last = col[2];
+    }
+    if ( col[3] != last )
+      polyline << QPointF(px, yMap.transform(col[3]));
+  }
+
+protected:
+
+  /// Only the visible points are drawn. More of them than pixels across
+  /// are reduced to the first, lowest, highest and last in each pixel
+  /// column and drawn without the symbols, which would overlap anyway.
+  void drawSeries(QPainter * painter, const QwtScaleMap & xMap, const QwtScaleMap & yMap,
+                  const QRectF & canvasRect, int from, int to) const {
+
+    if ( to < 0 )
+      to = dataSize() - 1;
+    if ( from > to )
+      return;
+    visibleRange(xMap, from, to);
+    if ( from > to )
+      return;
+
+    const double pixels = qAbs( xMap.p2() - xMap.p1() );
+    if ( to - from + 1 <= pixels ) {
+      QwtPlotCurve::drawSeries(painter, xMap, yMap, canvasRect, from, to);
+      return;
+    }
+
+    const QVector<double> & xData = series->xData;
+    QPolygonF polyline;
+    polyline.reserve( 4 * ( int(pixels) + 3 ) );
+    bool started = false;
+    int column = 0;
+    double col[4]; // first, lowest, highest, last
+    for (int idx = from ; idx <= to ; idx++) {
+      const double val = at(idx);
+      if ( isnan(val) )
+        continue;
+      const int pcol = (int) floor( xMap.transform(xData[idx]) );
+      if ( ! started  ||  pcol != column ) {
+        if (started)
+          addColumn(polyline, column, col, yMap);
+        started = true;
+        column = pcol;
+        col[0] = col[1] = col[2] = val;
+      }
+      col[1] = qMin(col[1], val);
+      col[2] = qMax(col[2], val);
+      col[3] = val;
+    }
+    if (started)
+      addColumn(polyline, column, col, yMap);
+
+    const double pw = qMax(1.0, pen().widthF());
+    const QRectF clipRect = canvasRect.adjusted(-pw, -pw, pw, pw);
+    painter->setPen(pen());
+    QwtPainter::drawPolyline( painter, QwtClipper::clipPolygonF(clipRect, polyline) );
+
+  }
 
 public :
 
   QwtPlotGrid * grid;
 
-  PlotLine(const QVector<double> & _yData, double xStart, double xEnd) :
+  PlotLine(const ScanData * store, int column, int size, double xStart, double xEnd) :
     QwtPlotCurve(),
-    PlotData(),
+    PlotData(store, column, size),
     grid(new QwtPlotGrid)
   {
 
@@ -168,13 +304,11 @@ public :
     grid->setMinPen(Qt::DotLine);
 #endif
 
-    _size = _yData.size();
     QVector<double> xData(_size);
-    for (int icur=0 ; icur < _size ; icur++)
+    for (size_t icur=0 ; icur < _size ; icur++)
       xData[icur] = xStart + icur*(xEnd-xStart)/(_size-1);
-    arrayData = new QwtPointArrayData( xData, _yData);
-    setData(arrayData);
-    _data = const_cast<double *>( arrayData->yData().data() );
+    series = new LineSeries(this, xData);
+    setData(series);
     updateData();
 
   }
@@ -183,238 +317,371 @@ public :
   ~PlotLine() {
     grid->detach();
     delete grid;
-  //  delete arrayData;
   }
 
   void updateData() {
     PlotData::updateData();
-    QRectF bnd = arrayData->boundingRect();
-    bnd.setBottom(min());
-    bnd.setTop(max());
-    arrayData->setRectOfInterest(bnd);
-  }
-
-  bool updateData(double point) {
-    bool ret = PlotData::updateData(point);
-    int idx=0;
-    while ( idx < _size && ! isnan(*( _data+idx)) )
-      idx++;
-    ret |= ( (int) dataSize() != idx );
-    if (ret) {
-      QRectF bnd = arrayData->boundingRect();
-      bnd.setBottom(min());
-      bnd.setTop(max());
-      arrayData->setRectOfInterest(bnd);
-    }
+    updateBounds();
+  }
+
+  bool updateData(size_t idx, double point) {
+    const bool ret = PlotData::updateData(idx, point);
+    if (ret)
+      updateBounds();
     return ret;
   }
 
+  // Inserts the point off the initial grid keeping x sorted.
+  // From here on the line keeps its own copy of the values.
+  void insertPoint(double x, double y) {
+    if ( _own.isEmpty() ) {
+      _own.resize(_size);
+      for (size_t idx = 0 ; idx < _size ; idx++)
+        _own[idx] = at(idx);
+    }
+    QVector<double> & xData = series->xData;
+    const bool ascending = xData.size() < 2  ||  xData.front() <= xData.back();
+    const int idx = ascending
+        ? std::lower_bound(xData.begin(), xData.end(), x) - xData.begin()
+        : std::lower_bound(xData.begin(), xData.end(), x, std::greater<double>()) - xData.begin();
+    xData.insert(idx, x);
+    _own.insert(idx, y);
+    _size = _own.size();
+    _filled = _size;
+    PlotData::updateData(idx, y);
+    updateBounds();
+  }
+
   double value(double pos) {
     if (_size<1)
       return NAN;
-    const double xStart = arrayData->xData().front();
-    const double xEnd   = arrayData->xData().back();
+    const QVector<double> & xData = series->xData;
+    const double xStart = xData.front();
+    const double xEnd   = xData.back();
     if ( _size < 1  ||  xStart == xEnd  ||  pos < qMin(xStart, xEnd)  ||  pos > qMax(xStart, xEnd) )
       return NAN;
-    int idx = (_size-1) * ( pos - xStart ) / (xEnd - xStart);
-    return arrayData->yData().at(idx);
+    // the grid may be non-uniform after insertPoint()
+    const int idx = xStart < xEnd
+        ? std::upper_bound(xData.begin(), xData.end(), pos) - xData.begin() - 1
+        : std::upper_bound(xData.begin(), xData.end(), pos, std::greater<double>()) - xData.begin() - 1;
+    return at(qBound(0, idx, (int) _size - 1));
   }
 
 };
 
 
 
+/// log2 of the mantissa 0.5 <= m < 1 returned by frexp(): log2Table[i] at m = 0.5 + i / 2 / log2Steps.
+static const int log2Steps = 4096;
+static QVector<double> makeLog2Table() {
+  QVector<double> table(log2Steps + 1);
+  for (int i = 0 ; i <= log2Steps ; i++)
+    table[i] = log2( 0.5 + 0.5 * i / log2Steps );
+  return table;
+}
+static const QVector<double> log2Table = makeLog2Table();
+
+/// log10 of the positive _value_ from the table, interpolated.
+static inline double fastLog10(double value) {
+  int exp;
+  const double pos = ( 2 * frexp(value, &exp) - 1 ) * log2Steps;
+  const int idx = qMin( (int) pos, log2Steps - 1 );
+  const double log2m = log2Table[idx] + ( pos - idx ) * ( log2Table[idx+1] - log2Table[idx] );
+  return ( exp + log2m ) * M_LOG10E * M_LN2;
+}
 
 
+/// Linear colour map read from a table: a clamp and an index per pixel.
+/// The table is built by prepare() for one interval; other intervals are
+/// mapped without it. It is not rebuilt on the fly because the spectrogram
+/// renders in several threads.
+class LutColorMap : public QwtLinearColorMap {
 
+private:
 
-class MapRasterDataOrig : public QwtRasterData {
-
-public:
-
-  int width;
-  int height;
-  const double * zData;
-
-  MapRasterDataOrig(const double * _zData, int _width, int _height,
-                double xStart, double xEnd,
-                double yStart, double yEnd) :
-    width(_width),
-    height(_height),
-    zData(_zData)
-
-  {
-
-    if ( ! zData || ! (width*height) )
-      throw_error("No or zero-sized data", "PlotMap");
-
-    if (xStart == xEnd) {
-      xStart = 1;
-      xEnd = width;
+  static const int lutSize = 1024;
+  const bool logScale;
+  QwtInterval lutRange;
+  double lo;            ///< interval on the scale of the table
+  double hi;
+  double scale;         ///< table entries per unit of the scale
+  QVector<QRgb> lut;
+  QVector<unsigned char> indexLut;
+
+  /// Interval on the linear or the log scale: ten decades below a non-positive minimum.
+  void scaled(const QwtInterval & interval, double & min, double & max) const {
+    min = interval.minValue();
+    max = interval.maxValue();
+    if (!logScale)
+      return;
+    if ( max <= 0 ) {
+      min = max = 0;
+    } else {
+      max = log10(max);
+      min = min > 0  ?  log10(min)  :  max - 10;
     }
-    setInterval(Qt::XAxis, QwtInterval(xStart,xEnd));
+  }
 
-    if (yStart == yEnd) {
-      yStart = 1;
-      yEnd = height;
-    }
-    setInterval(Qt::YAxis, QwtInterval(yStart,yEnd));
+  inline double toScale(double value) const {
+    if (!logScale)
+      return value;
+    if ( value <= 0.0 )
+      return NAN;
+    return isinf(value)  ?  value  :  fastLog10(value);
+  }
 
+  /// -1 for NaN.
+  inline int lutIndex(double value) const {
+    const double sv = toScale(value);
+    if ( isnan(sv) )
+      return -1;
+    const double pos = ( sv - lo ) * scale;
+    return ! ( pos > 0 )  ?  0  :  pos >= lutSize  ?  lutSize - 1  :  (int) pos;
   }
 
+public:
 
-  double value (double x, double y) const {
+  explicit LutColorMap(bool _logScale = false)
+    : logScale(_logScale), lo(0), hi(0), scale(0) {}
+
+  void prepare(const QwtInterval & interval) {
+    if ( ! lut.isEmpty()  &&  lutRange.minValue() == interval.minValue()
+         &&  lutRange.maxValue() == interval.maxValue() )
+      return;
+    lutRange = interval;
+    scaled(interval, lo, hi);
+    scale = hi > lo  ?  lutSize / ( hi - lo )  :  0;
+    const QwtInterval sint(lo, hi);
+    lut.resize(lutSize);
+    indexLut.resize(lutSize);
+    for (int i = 0 ; i < lutSize ; i++) {
+      const double sv = hi > lo  ?  lo + ( i + 0.5 ) / scale  :  lo;
+      lut[i] = QwtLinearColorMap::rgb(sint, sv);
+      indexLut[i] = QwtLinearColorMap::colorIndex(sint, sv);
+    }
+  }
 
-    const QwtInterval & xInt = interval(Qt::XAxis);
-    const QwtInterval & yInt = interval(Qt::YAxis);
+  inline bool prepared(const QwtInterval & interval) const {
+    return ! lut.isEmpty()
+        &&  lutRange.minValue() == interval.minValue()
+        &&  lutRange.maxValue() == interval.maxValue();
+  }
 
-    double val;
-    if ( ! xInt.normalized().contains(x) || ! yInt.normalized().contains(y) )
-      val = NAN;
-    else {
-      double xwidth = xInt.maxValue() - xInt.minValue();
-      double ywidth = yInt.maxValue() - yInt.minValue();
-      val = * ( zData
-               + (int) ( (width-1) * ( x - xInt.minValue() ) / xwidth )
-               + width * (int) ( (height-1) * ( y - yInt.minValue() ) / ywidth ));
+  QRgb rgb(const QwtInterval & interval, double value) const {
+    if ( prepared(interval) ) {
+      const int idx = lutIndex(value);
+      return idx < 0  ?  0u  :  lut[idx];
     }
-    return val;
-
+    double min, max;
+    scaled(interval, min, max);
+    return QwtLinearColorMap::rgb( QwtInterval(min, max),
+                                   logScale && value <= 0.0  ?  NAN  :  logScale ? log10(value) : value );
   }
 
-  QRectF pixelHint( const QRectF & ) const {
-    const QwtInterval & xInt = interval(Qt::XAxis).normalized();
-    const QwtInterval & yInt = interval(Qt::YAxis).normalized();
-    return QRectF(xInt.minValue(), yInt.minValue(),
-                  xInt.width()/width,
-                  yInt.width()/height);
+  unsigned char colorIndex(const QwtInterval & interval, double value) const {
+    if ( prepared(interval) ) {
+      const int idx = lutIndex(value);
+      return idx < 0  ?  0  :  indexLut[idx];
+    }
+    double min, max;
+    scaled(interval, min, max);
+    return QwtLinearColorMap::colorIndex( QwtInterval(min, max),
+                                          logScale && value <= 0.0  ?  NAN  :  logScale ? log10(value) : value );
   }
 
+  /// Colours of the _count_ _values_ in a row; the table must be prepared.
+  void rgbRow(const double * values, QRgb * out, int count) const {
+    const QRgb * table = lut.constData();
+    for (int i = 0 ; i < count ; i++) {
+      const int idx = lutIndex(values[i]);
+      out[i] = idx < 0  ?  0u  :  table[idx];
+    }
+  }
 
 };
 
 
+class LogColorMap : public LutColorMap {
+public:
+  LogColorMap() : LutColorMap(true) {}
+};
 
 
 
+/// Map cells read from the PlotData: no copy of the values.
+/// Same geometry as QwtMatrixRasterData with the nearest neighbour resampling.
+class MapRasterData : public QwtRasterData {
 
+public:
 
+  const PlotData * pdata;
+  int width;
+  int height;
+  /// As scanned: the end can be below the start, while the intervals
+  /// reported to Qwt are normalized.
+  double xStart, xEnd, yStart, yEnd;
+
+  MapRasterData(const PlotData * _pdata, int _width,
+                double _xStart, double _xEnd,
+                double _yStart, double _yEnd) :
+    pdata(_pdata),
+    width(_width),
+    height(_pdata->size() / _width),
+    xStart(_xStart), xEnd(_xEnd),
+    yStart(_yStart), yEnd(_yEnd)
+  {
+    setInterval(Qt::XAxis, QwtInterval(xStart, xEnd).normalized());
+    setInterval(Qt::YAxis, QwtInterval(yStart, yEnd).normalized());
+  }
 
+  double value(double x, double y) const {
+    const QwtInterval & xInt = interval(Qt::XAxis);
+    const QwtInterval & yInt = interval(Qt::YAxis);
+    if ( ! xInt.contains(x) || ! yInt.contains(y) || ! xInt.width() || ! yInt.width() )
+      return NAN;
+    const int col = qBound(0, (int) ( width * ( x - xStart ) / ( xEnd - xStart ) ), width - 1);
+    const int row = qBound(0, (int) ( height * ( y - yStart ) / ( yEnd - yStart ) ), height - 1);
+    return pdata->at(row * width + col);
+  }
 
+  QRectF pixelHint( const QRectF & ) const {
+    const QwtInterval & xInt = interval(Qt::XAxis);
+    const QwtInterval & yInt = interval(Qt::YAxis);
+    return QRectF(xInt.minValue(), yInt.minValue(),
+                  xInt.width()/width,
+                  yInt.width()/height);
+  }
 
+};
 
 
 
+/// The map keeps the last rendered image and redraws only the cells changed
+/// since then. The whole image is rendered anew when the scales, the canvas
+/// size, the colour range or the colour map change.
+class PlotMap : public QwtPlotSpectrogram, public PlotData {
+private:
+  MapRasterData * arrayData;
 
+  mutable QImage cache;
+  mutable QwtScaleMap cacheX;
+  mutable QwtScaleMap cacheY;
+  mutable QRectF cacheArea;
+  mutable QwtInterval cacheRange;
+  mutable QRect dirty;  ///< cells changed since the cache was rendered
 
+  static bool sameMap(const QwtScaleMap & a, const QwtScaleMap & b) {
+    return a.s1() == b.s1()  &&  a.s2() == b.s2()  &&  a.p1() == b.p1()  &&  a.p2() == b.p2();
+  }
 
-
-
-
-
-
-
-
-
-
-
-class PlotMap : public QwtPlotSpectrogram, public PlotData {
-private:
-  QwtMatrixRasterData * arrayData;
+  /// Image pixels of the dirty cells, one pixel wider on each side.
+  QRect dirtyPixels(const QwtScaleMap & xMap, const QwtScaleMap & yMap) const {
+    const double x0 = arrayData->xStart;
+    const double y0 = arrayData->yStart;
+    const double cellW = ( arrayData->xEnd - x0 ) / arrayData->width;  // signed
+    const double cellH = ( arrayData->yEnd - y0 ) / arrayData->height;
+    const double xa = xMap.transform( x0 + dirty.left() * cellW );
+    const double xb = xMap.transform( x0 + ( dirty.right() + 1 ) * cellW );
+    const double ya = yMap.transform( y0 + dirty.top() * cellH );
+    const double yb = yMap.transform( y0 + ( dirty.bottom() + 1 ) * cellH );
+    const QRect pixels( QPoint( floor(qMin(xa, xb)) - 1, floor(qMin(ya, yb)) - 1 ),
+                        QPoint( ceil(qMax(xa, xb)) + 1, ceil(qMax(ya, yb)) + 1 ) );
+    return pixels & cache.rect();
+  }
 
 public :
 
-  PlotMap(const QVector<double> & _zData, int _width,
+  PlotMap(const ScanData * store, int column, int size, int width,
           double xStart, double xEnd,
           double yStart, double yEnd) :
     QwtPlotSpectrogram(),
-    PlotData(),
-    arrayData(new QwtMatrixRasterData)
+    PlotData(store, column, size),
+    arrayData(new MapRasterData(this, width, xStart, xEnd, yStart, yEnd))
   {
     setRenderThreadCount(0); // use system specific thread count
-    setColorMap(new QwtLinearColorMap);
-
-    arrayData->setInterval(Qt::XAxis, QwtInterval(xStart, xEnd));
-    arrayData->setInterval(Qt::YAxis, QwtInterval(yStart, yEnd));
-    arrayData->setValueMatrix(_zData, _width);
+    setColorMap(new LutColorMap);
     setData(arrayData);
     updateData();
-    _data = const_cast<double *>( arrayData->valueMatrix().data() );
-    _size = _zData.size();
-  }
-
-  ~PlotMap() {
-//    delete arrayData;
   }
 
   void setPlotInterval(QwtInterval & interval) {
     arrayData->setInterval(Qt::ZAxis, interval);
   }
 
+  void setColorMap(QwtColorMap * colorMap) {
+    cache = QImage();
+    QwtPlotSpectrogram::setColorMap(colorMap);
+  }
+
   void updateData() {
+    cache = QImage();
     PlotData::updateData();
   }
 
-  double value(const QPointF & pos) {
-    return arrayData->value(pos.x(),pos.y());
+  bool updateData(size_t idx, double point) {
+    if ( idx < _size ) {
+      const QRect cell(idx % arrayData->width, idx / arrayData->width, 1, 1);
+      dirty = dirty.isNull()  ?  cell  :  dirty | cell;
+    }
+    return PlotData::updateData(idx, point);
   }
 
-};
-
-
-
-
-
-
-
-
-
-class LogColorMap : public QwtLinearColorMap {
-
-public:
-
-  LogColorMap() {}
-
-  unsigned char colorIndex (const QwtInterval &interval, double value) const {
-
-    QwtInterval ival = interval;
-    if (interval.maxValue() <= 0)
-      ival.setInterval(0,0);
-    else if (ival.minValue()<=0)
-      ival.setMinValue(ival.maxValue()/1e-10);
-    else
-      ival.setInterval( log10(ival.minValue()), log10(ival.maxValue()) );
-
-    return QwtLinearColorMap::colorIndex(ival, value <= 0.0 ? NAN : log10(value) );
+  QImage renderImage(const QwtScaleMap & xMap, const QwtScaleMap & yMap,
+                     const QRectF & area, const QSize & imageSize) const {
+
+    const QwtInterval range = arrayData->interval(Qt::ZAxis);
+    const LutColorMap * lutMap = dynamic_cast<const LutColorMap *>(colorMap());
+    if (lutMap) // before the render threads read it
+      const_cast<LutColorMap *>(lutMap)->prepare(range);
+    const bool reuse = ! cache.isNull()
+        && colorMap()->format() == QwtColorMap::RGB
+        && cache.size() == imageSize  &&  cacheArea == area
+        && sameMap(cacheX, xMap)  &&  sameMap(cacheY, yMap)
+        && cacheRange.minValue() == range.minValue()
+        && cacheRange.maxValue() == range.maxValue();
+
+    if ( ! reuse ) {
+      cache = QwtPlotSpectrogram::renderImage(xMap, yMap, area, imageSize);
+      cacheX = xMap;
+      cacheY = yMap;
+      cacheArea = area;
+      cacheRange = range;
+    } else if ( ! dirty.isNull() ) { // same as QwtPlotSpectrogram::renderTile()
+      const QRect pixels = dirtyPixels(xMap, yMap);
+      QVector<double> values(pixels.width());
+      for ( int y = pixels.top() ; y <= pixels.bottom() ; y++ ) {
+        const double ty = yMap.invTransform(y);
+        QRgb * line = reinterpret_cast<QRgb *>( cache.scanLine(y) ) + pixels.left();
+        for ( int x = pixels.left() ; x <= pixels.right() ; x++ )
+          values[x - pixels.left()] = arrayData->value(xMap.invTransform(x), ty);
+        if (lutMap) {
+          lutMap->rgbRow(values.constData(), line, values.size());
+        } else {
+          foreach (double val, values)
+            *line++ = colorMap()->rgb(range, val);
+        }
+      }
+    }
+    dirty = QRect();
+    return cache;
 
   }
 
-  QRgb rgb(const QwtInterval &interval, double value ) const {
-
-    QwtInterval ival = interval;
-    if (interval.maxValue() <= 0)
-      ival.setInterval(0,0);
-    else if (ival.minValue()<=0)
-      ival.setMinValue(ival.maxValue()/1e-10);
-    else
-      ival.setInterval( log10(ival.minValue()), log10(ival.maxValue()) );
-
-    return QwtLinearColorMap::rgb(ival, value <= 0.0 ? NAN : log10(value) );
-
+  double value(const QPointF & pos) {
+    return arrayData->value(pos.x(),pos.y());
   }
 
 };
 
 
 
-
-
-
-
 Graph::Graph(QWidget *parent) :
   QWidget(parent),
   ui(new Ui::Graph),
-  pdata(0)
+  pdata(0),
+  replotTimer(this),
+  replotPending(false),
+  rangePending(false)
 {
 
   ui->setupUi(this);
@@ -432,6 +699,10 @@ Graph::Graph(QWidget *parent) :
   connect(ui->showGrid, SIGNAL(toggled(bool)), SLOT(showGrid()));
   connect(ui->logY, SIGNAL(toggled(bool)), SLOT(setLogarithmic()));
 
+  replotTimer.setSingleShot(true);
+  connect(&replotTimer, SIGNAL(timeout()), SLOT(replotNow()));
+  sinceReplot.start();
+
 }
 
 Graph::~Graph(){
@@ -448,25 +719,24 @@ void Graph::changePlot() {
   }
 }
 
-double * Graph::changePlot(const QVector<double> & yData, double xStart, double xEnd) {
+void Graph::changePlot(const ScanData * store, int column, int size, double xStart, double xEnd) {
   changePlot();
-  pdata = new PlotLine(yData, xStart, xEnd);
+  pdata = new PlotLine(store, column, size, xStart, xEnd);
   ui->plot->enableAxis(QwtPlot::yRight, false);
   ui->plot->setAxisScale(QwtPlot::xBottom, xStart, xEnd);
   dynamic_cast<PlotLine*>(pdata)->attach(ui->plot);
   updateData();
-  return pdata->data();
 }
 
 
 
-double * Graph::changePlot(const QVector<double> & zData, int width,
+void Graph::changePlot(const ScanData * store, int column, int size, int width,
                        double xStart, double xEnd,
                        double yStart, double yEnd)  {
-  if ( ! zData.size() || width <= 0 || zData.size()%width )
+  if ( ! size || width <= 0 || size%width )
     throw_error("Bad data for map plot", "Graph");
   changePlot();
-  pdata = new PlotMap(zData, width, xStart, xEnd, yStart, yEnd);
+  pdata = new PlotMap(store, column, size, width, xStart, xEnd, yStart, yEnd);
   ui->plot->setAxisScaleEngine(QwtPlot::yLeft, new QwtLinearScaleEngine);
   ui->plot->setAxisScale(QwtPlot::yLeft, yStart, yEnd );
   ui->plot->setAxisScale(QwtPlot::xBottom, xStart, xEnd );
@@ -475,7 +745,14 @@ double * Graph::changePlot(const QVector<double> & zData, int width,
   updateData();
   if (ui->showGrid->isChecked())
     showGrid();
-  return pdata->data();
+}
+
+
+void Graph::setOffset(int offset) {
+  if (!pdata)
+    return;
+  pdata->setOffset(offset);
+  updateData();
 }
 
 
@@ -487,14 +764,64 @@ void Graph::updateData() {
   ui->plot->replot();
 }
 
-void Graph::updateData(double point) {
-  if (!pdata)
+void Graph::insertPoint(double x, double y) {
+  PlotLine * line = dynamic_cast<PlotLine*>(pdata);
+  if (!line)
     return;
-  if ( pdata->updateData(point) &&
-       (ui->autoMin->isChecked() || ui->autoMax->isChecked()) )
+  line->insertPoint(x, y);
+  scheduleReplot( ui->autoMin->isChecked() || ui->autoMax->isChecked() );
+}
+
+void Graph::updateData(int idx, double point) {
+  if (!pdata || idx < 0)
+    return;
+  scheduleReplot( pdata->updateData(idx, point) &&
+                  (ui->autoMin->isChecked() || ui->autoMax->isChecked()) );
+}
+
+
+/// The first point after a quiet period is plotted at once, the following
+/// ones together once the period of the maximum rate passes.
+void Graph::scheduleReplot(bool range) {
+  replotPending = true;
+  rangePending |= range;
+  if ( replotTimer.isActive() )
+    return;
+  const qint64 period = 1000 / ui->maxRate->value();
+  replotTimer.start( qMax<qint64>(0, period - sinceReplot.elapsed()) );
+}
+
+
+/// Neither the hidden plot nor the one in a minimized window are drawn.
+bool Graph::shown() const {
+  return isVisible()
+      && ! window()->isMinimized()
+      && ! ( parentWidget() && parentWidget()->isMinimized() );
+}
+
+
+void Graph::replotNow() {
+  if ( ! replotPending )
+    return;
+  if ( ! shown() ) { // check again later: not all ways to show the plot send the event
+    replotTimer.start( 1000 / ui->maxRate->value() );
+    return;
+  }
+  if ( rangePending )
     updateRange();
   else
     ui->plot->replot();
+  replotPending = rangePending = false;
+  sinceReplot.restart();
+}
+
+
+void Graph::showEvent(QShowEvent * event) {
+  QWidget::showEvent(event);
+  if ( replotPending ) {
+    replotTimer.stop();
+    replotNow();
+  }
 }
 
 
@@ -516,8 +843,9 @@ void  Graph::updateRange() {
     ui->plot->setAxisScale(QwtPlot::yLeft, plotInterval.minValue(), plotInterval.maxValue());
   } else if (dynamic_cast<PlotMap*>(pdata)) {
     dynamic_cast<PlotMap*>(pdata)->setPlotInterval(plotInterval);
-    ui->plot->axisWidget(QwtPlot::yRight)
-        ->setColorMap( plotInterval, ui->logY->isChecked() ? new LogColorMap : new QwtLinearColorMap);
+    LutColorMap * barMap = new LutColorMap(ui->logY->isChecked());
+    barMap->prepare(plotInterval);
+    ui->plot->axisWidget(QwtPlot::yRight)->setColorMap(plotInterval, barMap);
     ui->plot->setAxisScale(QwtPlot::yRight, plotInterval.minValue(), plotInterval.maxValue());
   }
 
@@ -560,7 +888,7 @@ void Graph::setLogarithmic() {
     else
       ui->plot->setAxisScaleEngine(QwtPlot::yLeft, new QwtLinearScaleEngine);
   } else if (dynamic_cast<PlotMap*>(pdata)) {
-    QwtColorMap * cmap = ui->logY->isChecked() ? new LogColorMap : new QwtLinearColorMap;
+    QwtColorMap * cmap = ui->logY->isChecked() ? new LogColorMap : new LutColorMap;
     dynamic_cast<PlotMap*>(pdata)->setColorMap(cmap);
     if (ui->logY->isChecked())
 #if QWT_VERSION >= 0x060100
@@ -10,9 +10,13 @@
 #include <qwt_plot_canvas.h>
 #include <QDebug>
 #include <QPrinter>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include <blitz/array.h>
 
+#include "scandata.h"
+
 
 //typedef blitz::Array<double,1> Line;
 //typedef blitz::Array<double,2> Map;
@@ -69,24 +73,41 @@ private:
   PlotData * pdata;
   QwtPlotGrid * grid;
 
+  // Replots of the new points are coalesced to ui->maxRate.
+  QTimer replotTimer;
+  QElapsedTimer sinceReplot;
+  bool replotPending;
+  bool rangePending;  ///< the pending replot also updates the range
+  void scheduleReplot(bool range);
+  bool shown() const;
+
 public:
 
   explicit Graph(QWidget *parent = 0);
   ~Graph();
 
-  double * changePlot(const QVector<double> & yData, double xStart, double xEnd);
-  double * changePlot(const QVector<double> & zData, int width,
+  /// The plots read the _column_ of the _store_: _size_ rows from the offset.
+  void changePlot(const ScanData * store, int column, int size, double xStart, double xEnd);
+  void changePlot(const ScanData * store, int column, int size, int width,
                   double xStart, double xEnd,
                   double yStart, double yEnd);
-  void updateData(double point);
+  void setOffset(int offset);
+  /// The point _idx_ of the plot was set: constant time.
+  void updateData(int idx, double point);
   void updateData();
+  void insertPoint(double x, double y);
   void print(QPrinter & printer);
   void setTitle(const QString & text);
 
+protected:
+
+  void showEvent(QShowEvent * event);
+
 private slots:
 
   void changePlot();
   void updateRange();
+  void replotNow();
   void showGrid();
   void setLogarithmic();
   void pick(const QPointF & point);
@@ -0,0 +1,210 @@
+#include "headless.h"
+#include "error.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+
+HeadlessScan::HeadlessScan(const QString & _configFile, QObject * parent)
+  : QObject(parent)
+  , configFile(_configFile)
+  , engine(new ScanEngine(this))
+  , out(stdout)
+  , total(0)
+  , signalNotifier(0)
+  , interrupts(0)
+{
+  setObjectName("HeadlessScan");
+  connect(engine, SIGNAL(started(int)), SLOT(onStarted(int)));
+  connect(engine, SIGNAL(pointDone(ScanPoint)), SLOT(onPointDone(ScanPoint)));
+  connect(engine, SIGNAL(finished(bool)), SLOT(onFinished(bool)));
+}
+
+
+/// The same data file name the GUI would pick (see MainWindow::prepareAutoSave).
+static QString dataFileName(QSettings & settings) {
+
+  QString dn = settings.value("saveDir", QDir::homePath()).toString();
+  if ( ! dn.endsWith('/') )
+    dn += "/";
+  const QFileInfo dirInfo(dn);
+  if ( ! dirInfo.exists() || ! dirInfo.isWritable() )
+    return QString();
+
+  QString name = settings.value("saveName").toString();
+  if ( settings.value("autoName", true).toBool() ) {
+    const QString fn = "scan_" +
+                       QDateTime::currentDateTime().toString("yyyy-MM-dd_hh-mm-ss");
+    const QString ext = ".dat";
+    int count = 1;
+    name = fn + ext;
+    while ( QFile::exists( dn + name ) )
+      name = fn + "_(" + QString::number(count++) + ")" + ext;
+  }
+
+  const QFileInfo fileInfo(dn + name);
+  if ( name.isEmpty()  ||  fileInfo.isDir()  ||  ( fileInfo.exists() && ! fileInfo.isWritable() ) )
+    return QString();
+  return dn + name;
+
+}
+
+
+/// True if any of the axes ends where it starts.
+static bool flatAxes(const QList<ScanAxis> & axes) {
+  foreach (const ScanAxis & ax, axes)
+    if ( ax.start == ax.end )
+      return true;
+  return false;
+}
+
+
+/// Checks what the GUI does not let start, except the motor limits:
+/// those are known only once the motors connect.
+static QString checkConfig(const ScanConfig & cfg) {
+  if ( cfg.xAxes.isEmpty() )
+    return "No X axis motors.";
+  if ( flatAxes(cfg.xAxes) )
+    return "X axis motor with the same start and end.";
+  if ( ! cfg.listed()  &&  cfg.xPoints < 2 )
+    return "Less than two X points.";
+  if ( cfg.scan2D  &&  cfg.yAxes.isEmpty() )
+    return "No Y axis motors in the 2D scan.";
+  if ( cfg.scan2D  &&  flatAxes(cfg.yAxes) )
+    return "Y axis motor with the same start and end.";
+  if ( cfg.grid2D()  &&  cfg.yPoints < 2 )
+    return "Less than two Y points.";
+  foreach (const ScanLevel & lev, cfg.outer) {
+    if ( flatAxes(lev.axes) )
+      return "Outer axis motor with the same start and end.";
+    if ( lev.points < 2 )
+      return "Less than two points in an outer level.";
+  }
+  if ( cfg.signalNames.isEmpty() )
+    return "No signals.";
+  if ( cfg.signalNames.contains(QString()) )
+    return "Signal with no name.";
+  return QString();
+}
+
+
+bool HeadlessScan::start() {
+
+  if ( ! QFileInfo(configFile).exists() ) {
+    warn("Configuration file \"" + configFile + "\" does not exist.", this);
+    return false;
+  }
+  QSettings settings(configFile, QSettings::IniFormat);
+  ScanConfig cfg;
+  QString problem = ScanEngine::readConfig(settings, cfg);
+  if ( problem.isEmpty() )
+    problem = checkConfig(cfg);
+  if ( problem.isEmpty() ) {
+    cfg.fileName = dataFileName(settings);
+    if ( cfg.fileName.isEmpty() )
+      problem = "Can not write the data file into \""
+          + settings.value("saveDir", QDir::homePath()).toString() + "\".";
+  }
+  if ( ! problem.isEmpty() ) {
+    warn("Bad configuration \"" + configFile + "\": " + problem, this);
+    return false;
+  }
+
+  out << "Scan \"" << configFile << "\" into \"" << cfg.fileName << "\".\n";
+  out.flush();
+  catchSignals();
+  clock.start();
+  // queued: the scan starts once the event loop runs
+  QMetaObject::invokeMethod(engine, "start", Qt::QueuedConnection, Q_ARG(ScanConfig, cfg));
+  return true;
+
+}
+
+
+void HeadlessScan::onStarted(int totalPoints) {
+  total = totalPoints;
+}
+
+
+void HeadlessScan::onPointDone(const ScanPoint & pt) {
+  out << pt.index + 1 << "/" << total << " "
+      << QString::number(clock.elapsed() / 1000.0, 'f', 1) << "s ";
+  foreach (double pos, pt.xPos)
+    out << pos << " ";
+  foreach (double pos, pt.yPos)
+    out << pos << " ";
+  foreach (double pos, pt.outerPos)
+    out << pos << " ";
+  out << ": " << pt.values.join(" ") << "\n";
+  out.flush();
+}
+
+
+void HeadlessScan::onFinished(bool stopped) {
+  out << ( stopped ? "Scan stopped" : "Scan complete" ) << " after "
+      << QString::number(clock.elapsed() / 1000.0, 'f', 1) << "s.\n";
+  out.flush();
+  QCoreApplication::exit( stopped ? 1 : 0 );
+}
+
+
+/// Self-pipe: the handler only writes into it, the event loop reads.
+static int signalFds[2] = { -1, -1 };
+
+static void onUnixSignal(int) {
+  const char sig = 1;
+  if ( ::write(signalFds[0], &sig, sizeof(sig)) < 0 )
+    return; // nothing else is safe in the handler
+}
+
+
+void HeadlessScan::catchSignals() {
+
+  if ( signalNotifier )
+    return;
+  if ( ::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFds) ) {
+    warn("Can not catch the signals: the scan can be stopped only by killing it.", this);
+    return;
+  }
+  signalNotifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, this);
+  connect(signalNotifier, SIGNAL(activated(int)), SLOT(onSignal()));
+
+  struct sigaction action;
+  action.sa_handler = onUnixSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &action, 0);
+  sigaction(SIGTERM, &action, 0);
+
+}
+
+
+void HeadlessScan::onSignal() {
+
+  signalNotifier->setEnabled(false);
+  char sig;
+  if ( ::read(signalFds[1], &sig, sizeof(sig)) < 0 )
+    warn("Can not read the caught signal.", this);
+  signalNotifier->setEnabled(true);
+
+  if ( ! engine->isScanning() ) { // not started yet or already finished
+    QCoreApplication::exit(1);
+    return;
+  }
+  if ( ! interrupts++ ) {
+    out << "Stopping the scan.\n";
+    out.flush();
+    engine->stop();
+  } else {
+    out << "Shutting the scan down.\n";
+    out.flush();
+    engine->shutdown(); // onFinished() exits
+  }
+
+}
@@ -0,0 +1,51 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QSettings>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include "scanengine.h"
+
+
+/// Runs the scan stored in the configuration file without any widgets.
+///
+/// The configuration is the INI file written by the GUI (see
+/// MainWindow::storeSettings). The data file is the same as the one written
+/// from the GUI; the progress is printed on stdout, one line per point.
+/// The application exits when the scan is finished: with 0 if it was
+/// completed, 1 otherwise. SIGINT or SIGTERM stops the scan as the Stop
+/// button does; the second one shuts it down without waiting for the motors.
+class HeadlessScan : public QObject {
+  Q_OBJECT;
+
+public:
+
+  explicit HeadlessScan(const QString & configFile, QObject * parent = 0);
+
+  bool start();
+
+private:
+
+  QString configFile;
+  ScanEngine * engine;
+  QTextStream out;
+  QElapsedTimer clock;
+  int total;
+  QSocketNotifier * signalNotifier;
+  int interrupts;
+
+  void catchSignals();
+
+private slots:
+
+  void onStarted(int totalPoints);
+  void onPointDone(const ScanPoint & pt);
+  void onFinished(bool stopped);
+  void onSignal();
+
+};
+
+
+#endif // HEADLESS_H
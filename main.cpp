@@ -1,8 +1,18 @@
 #include <QApplication>
 #include "mainwindow.h"
+#include "headless.h"
 
 int main(int argc, char *argv[])
 {
+    clargs args(argc, argv);
+    if (args.headless) {
+        QCoreApplication a(argc, argv);
+        HeadlessScan scan(QString::fromStdString(args.config));
+        if ( ! scan.start() )
+            return 1;
+        return a.exec();
+    }
+
     QApplication a(argc, argv);
     MainWindow w(argc, argv);
     w.show();
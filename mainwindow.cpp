@@ -10,6 +10,7 @@
 #include<QCursor>
 #include <QAction>
 #include <QClipboard>
+#include "error.h"
 
 
 
@@ -20,17 +21,9 @@
 
 #include <poptmx.h>
 
-struct clargs {
-  std::string command;
-  bool start;
-  std::string config;
-  poptmx::OptionTable table;
-  clargs(int argc, char *argv[]);
-};
-
-
 clargs::clargs(int argc, char *argv[]) :
   start(false),
+  headless(false),
   config(QDir::homePath().toStdString() + "/.scanmx"),
   table("Motor scan.")
 {
@@ -40,6 +33,10 @@ clargs::clargs(int argc, char *argv[]) :
       .add(poptmx::OPTION,   &start, 's', "start",
            "Starts scan automatically.",
            "Equal pushing the \"Start\" button after entering all values.")
+      .add(poptmx::OPTION,   &headless, 'H', "headless",
+           "Runs the scan without the GUI.",
+           "The scan from the configuration file is started at once and the"
+           " progress is printed on stdout. Exits when the scan is finished.")
       .add(poptmx::OPTION,   &config, 'c', "config",
            "Configuration file to load.",
            "")
@@ -72,14 +69,36 @@ MainWindow::MainWindow(int argc, char *argv[], QWidget *parent) :
   ui(new Ui::MainWindow),
   contextPos(NAN,NAN),
   contextVal(NAN),
-  nowLoading(true)
+  nowLoading(true),
+  engine(new ScanEngine),
+  scanFrom(0),
+  queueRunning(false)
 {
   clargs args(argc, argv);
 
+  engine->moveToThread(&engineThread);
+  connect(&engineThread, SIGNAL(finished()), engine, SLOT(deleteLater()));
+  connect(engine, SIGNAL(pointDone(ScanPoint)), SLOT(onPointDone(ScanPoint)));
+  connect(engine, SIGNAL(finished(bool)), SLOT(onScanFinished(bool)));
+  connect(engine, SIGNAL(paused(bool)), SLOT(onPaused(bool)));
+  connect(engine, SIGNAL(signalTimed(QString,double)), SLOT(onSignalTimed(QString,double)));
+  engineThread.start();
+
   ui->setupUi(this);
+  table = new DataModel(&scanData, this);
+  ui->dataTable->setModel(table);
   connect(ui->addSignal, SIGNAL(clicked()), SLOT(addSignal()));
   connect(ui->startStop, SIGNAL(clicked()), SLOT(startStop()));
+  connect(ui->pauseResume, SIGNAL(clicked()), SLOT(pauseResume()));
+  connect(ui->resumeScan, SIGNAL(clicked()), SLOT(resumeScan()));
+  connect(ui->queueCurrent, SIGNAL(clicked()), SLOT(queueCurrent()));
+  connect(ui->queueFile, SIGNAL(clicked()), SLOT(queueFile()));
+  connect(ui->queueRemove, SIGNAL(clicked()), SLOT(queueRemove()));
+  connect(ui->queueRun, SIGNAL(clicked()), SLOT(runQueue()));
   connect(ui->browseSaveDir, SIGNAL(clicked()), SLOT(browseAutoSave()));
+  connect(ui->browsePointList, SIGNAL(clicked()), SLOT(browsePointList()));
+  connect(ui->pointList, SIGNAL(toggled(bool)), SLOT(loadPointList()));
+  connect(ui->pointListFile, SIGNAL(editingFinished()), SLOT(loadPointList()));
   connect(ui->printResult, SIGNAL(clicked()), SLOT(printResult()));
   connect(ui->saveResult, SIGNAL(clicked()), SLOT(saveResult()));
   connect(ui->qtiResults, SIGNAL(clicked()), SLOT(openQti()));
@@ -91,6 +110,10 @@ MainWindow::MainWindow(int argc, char *argv[], QWidget *parent) :
   connect(ui->delX, SIGNAL(clicked()), SLOT(delX()));
   connect(ui->addY, SIGNAL(clicked()), SLOT(addY()));
   connect(ui->delY, SIGNAL(clicked()), SLOT(delY()));
+  connect(ui->addOuter, SIGNAL(clicked()), SLOT(addOuter()));
+  connect(ui->delOuter, SIGNAL(clicked()), SLOT(delOuter()));
+  connect(ui->slice, SIGNAL(valueChanged(int)), SLOT(showSlice(int)));
+  ui->slice->setVisible(false);
 
 
 
@@ -101,6 +124,7 @@ MainWindow::MainWindow(int argc, char *argv[], QWidget *parent) :
 
   xAxes << ui->xAxis;
   yAxes << ui->yAxis;
+  ui->yAxis->setFlyAvailable(false);
 
   // context menue
   contextMenu = new QMenu(this);
@@ -150,10 +174,27 @@ MainWindow::MainWindow(int argc, char *argv[], QWidget *parent) :
   connect(ui->yAxis->motor->motor(), SIGNAL(changedPv(QString)), SLOT(storeSettings()));
   connect(ui->scan2D, SIGNAL(toggled(bool)), SLOT(updatePlots()));
   connect(ui->scan2D, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->snake, SIGNAL(toggled(bool)), SLOT(storeSettings()));
   connect(ui->after, SIGNAL(activated(QString)), SLOT(storeSettings()));
+  connect(ui->pipeline, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->coordinated, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->adaptive, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->adaptivePoints, SIGNAL(valueChanged(int)), SLOT(storeSettings()));
+  connect(ui->adaptiveTolerance, SIGNAL(valueChanged(double)), SLOT(storeSettings()));
+  connect(ui->adaptiveSignal, SIGNAL(activated(int)), SLOT(storeSettings()));
   connect(ui->saveDir, SIGNAL(editingFinished()), SLOT(storeSettings()));
   connect(ui->saveName, SIGNAL(editingFinished()), SLOT(storeSettings()));
   connect(ui->autoName, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->persistentScripts, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->pointList, SIGNAL(toggled(bool)), SLOT(storeSettings()));
+  connect(ui->pointListFile, SIGNAL(editingFinished()), SLOT(storeSettings()));
+  connect(ui->relaxOuter, SIGNAL(valueChanged(double)), SLOT(storeSettings()));
+  connect(ui->relaxY, SIGNAL(valueChanged(double)), SLOT(storeSettings()));
+  connect(ui->exposures, SIGNAL(valueChanged(int)), SLOT(storeSettings()));
+  connect(ui->targetError, SIGNAL(valueChanged(double)), SLOT(storeSettings()));
+  connect(ui->dataFormat, SIGNAL(activated(QString)), SLOT(storeSettings()));
+  connect(ui->flushInterval, SIGNAL(valueChanged(double)), SLOT(storeSettings()));
+  connect(ui->flushRows, SIGNAL(valueChanged(int)), SLOT(storeSettings()));
 
   nowLoading = false;
 
@@ -165,8 +206,28 @@ MainWindow::MainWindow(int argc, char *argv[], QWidget *parent) :
 }
 
 
+MainWindow::~MainWindow() {
+  // not stop(): the event loop of the thread would quit before the scan ends
+  QMetaObject::invokeMethod(engine, "shutdown", Qt::BlockingQueuedConnection);
+  engineThread.quit();
+  engineThread.wait();
+}
+
+
 void MainWindow::updatePlots() {
 
+  columns.clear();
+  QStringList headers;
+  foreach (Axis * ax, xAxes + ( ui->scan2D->isChecked() ? yAxes : QList<Axis*>() ) + outerAxes ) {
+    columns[ax] = headers.size();
+    headers << ax->motor->motor()->getPv();
+  }
+  foreach (Signal * sg, signalsE) {
+    columns[sg] = headers.size();
+    headers << sg->objectName();
+  }
+  table->reset(headers);
+
   const int xPoints = ui->xAxis->points();
   xAxisData.resize(xPoints);
 
@@ -181,11 +242,20 @@ void MainWindow::updatePlots() {
   for( int xpoint = 0 ; xpoint < xPoints ; xpoint++ )
     xAxisData[xpoint] = xStart + ( xpoint * ( xEnd - xStart ) ) / (xPoints - 1);
 
-  if ( ! ui->scan2D->isChecked() ) { // 2D
+  if ( ui->pointList->isChecked() ) { // listed points along the abscissa
+    const int points = qMax(1, pointListData.size());
+    xAxisData.resize(points);
+    for( int xpoint = 0 ; xpoint < points ; xpoint++ )
+      xAxisData[xpoint] = xpoint;
+    yAxisData.resize(1);
+    yAxisData.fill(0);
+    foreach (Signal * sig, signalsE)
+      sig->setData(&scanData, columns[sig], points, 0, points - 1);
+  } else if ( ! ui->scan2D->isChecked() ) { // 2D
     yAxisData.resize(1);
     yAxisData.fill(0);
     foreach (Signal * sig, signalsE)
-      sig->setData(xAxisData.size(), xStart, xEnd);
+      sig->setData(&scanData, columns[sig], xAxisData.size(), xStart, xEnd);
   } else { // 3D
 
     const int yPoints = ui->yAxis->points();
@@ -203,31 +273,20 @@ void MainWindow::updatePlots() {
       yAxisData[ypoint] = yStart + ( ypoint * ( yEnd - yStart ) ) / (yPoints - 1);
 
     foreach (Signal * sig, signalsE)
-      sig->setData(xPoints, yPoints, xStart, xEnd, yStart, yEnd);
+      sig->setData(&scanData, columns[sig], xPoints, yPoints, xStart, xEnd, yStart, yEnd);
 
   }
 
 
-  columns.clear();
-  ui->dataTable->setColumnCount(0);
-  ui->dataTable->setRowCount(0);
-
-  foreach (Axis * ax, xAxes + ( ui->scan2D->isChecked() ? yAxes : QList<Axis*>() ) ) {
-    QTableWidgetItem * tableItem = new QTableWidgetItem(ax->motor->motor()->getPv());
-    int tablePos = ui->dataTable->columnCount();
-    columns[ax] = tablePos;
-    ui->dataTable->insertColumn(tablePos);
-    ui->dataTable->setHorizontalHeaderItem(tablePos, tableItem);
-  }
-  foreach (Signal * sg, signalsE) {
-    QTableWidgetItem * tableItem = new QTableWidgetItem(sg->objectName());
-    int tablePos = ui->dataTable->columnCount();
-    columns[sg] = tablePos;
-    ui->dataTable->insertColumn(tablePos);
-    ui->dataTable->setHorizontalHeaderItem(tablePos, tableItem);
-  }
   updateHeaders();
 
+  int slices = 1;
+  foreach (Axis * ax, outerAxes)
+    slices *= ax->points();
+  ui->slice->setMaximum(slices);
+  ui->slice->setValue(1);
+  ui->slice->setVisible( ! outerAxes.isEmpty() );
+
   updateGUI();
 
 }
@@ -236,7 +295,12 @@ void MainWindow::updatePlots() {
 void MainWindow::updateHeaders() {
   QApplication::processEvents();
   foreach(QObject * obj, columns.keys())
-    ui->dataTable->horizontalHeaderItem(columns[obj])->setText(obj->objectName());
+    table->setHeader(columns[obj], obj->objectName());
+  const int adaptiveIdx = ui->adaptiveSignal->currentIndex();
+  ui->adaptiveSignal->clear();
+  foreach (Signal * sg, signalsE)
+    ui->adaptiveSignal->addItem(sg->objectName());
+  ui->adaptiveSignal->setCurrentIndex( qBound(0, adaptiveIdx, signalsE.size()-1) );
 }
 
 
@@ -254,13 +318,18 @@ void MainWindow::storeSettings() {
     localSettings->setValue("pv", ax->motor->motor()->getPv());
     localSettings->setValue("start", ax->start());
     localSettings->setValue("end", ax->end());
-    if (!i)
+    if (!i) {
       localSettings->setValue("points", ax->points());
+      localSettings->setValue("fly", ax->fly());
+      localSettings->setValue("flyTime", ax->flyTime());
+    }
     localSettings->setValue("mode", ax->modeString());
   }
   localSettings->endArray();
 
   localSettings->setValue("2D", ui->scan2D->isChecked());
+  localSettings->setValue("snake", ui->snake->isChecked());
+  localSettings->setValue("relaxY", ui->relaxY->value());
 
   localSettings->beginWriteArray("ymotors");
   for (int i=0; i< yAxes.size(); i++) {
@@ -275,10 +344,37 @@ void MainWindow::storeSettings() {
   }
   localSettings->endArray();
 
+  localSettings->beginWriteArray("outermotors");
+  for (int i=0; i< outerAxes.size(); i++) {
+    localSettings->setArrayIndex(i);
+    Axis * ax = outerAxes[i];
+    localSettings->setValue("pv", ax->motor->motor()->getPv());
+    localSettings->setValue("start", ax->start());
+    localSettings->setValue("end", ax->end());
+    localSettings->setValue("points", ax->points());
+    localSettings->setValue("mode", ax->modeString());
+  }
+  localSettings->endArray();
+  localSettings->setValue("relaxOuter", ui->relaxOuter->value());
+
   localSettings->setValue("afterScan", ui->after->currentText());
+  localSettings->setValue("pipeline", ui->pipeline->isChecked());
+  localSettings->setValue("coordinated", ui->coordinated->isChecked());
+  localSettings->setValue("adaptive", ui->adaptive->isChecked());
+  localSettings->setValue("adaptivePoints", ui->adaptivePoints->value());
+  localSettings->setValue("adaptiveTolerance", ui->adaptiveTolerance->value());
+  localSettings->setValue("adaptiveSignal", ui->adaptiveSignal->currentIndex());
   localSettings->setValue("saveDir", ui->saveDir->text());
   localSettings->setValue("saveName", ui->saveName->text());
   localSettings->setValue("autoName", ui->autoName->isChecked());
+  localSettings->setValue("persistentScripts", ui->persistentScripts->isChecked());
+  localSettings->setValue("exposures", ui->exposures->value());
+  localSettings->setValue("targetError", ui->targetError->value());
+  localSettings->setValue("dataFormat", ui->dataFormat->currentText());
+  localSettings->setValue("flushInterval", ui->flushInterval->value());
+  localSettings->setValue("flushRows", ui->flushRows->value());
+  localSettings->setValue("pointList", ui->pointList->isChecked());
+  localSettings->setValue("pointListFile", ui->pointListFile->text());
 
   localSettings->beginWriteArray("detectors");
   for (int i = 0; i < signalsE.size(); ++i) {
@@ -287,6 +383,17 @@ void MainWindow::storeSettings() {
   }
   localSettings->endArray();
 
+  localSettings->beginWriteArray("signalTimes");
+  int idx = 0;
+  foreach (const QString & name, signalTimes.keys()) {
+    localSettings->setArrayIndex(idx++);
+    localSettings->setValue("signal", name);
+    localSettings->setValue("time", signalTimes[name]);
+  }
+  localSettings->endArray();
+
+  updateEstimate();
+
 }
 
 
@@ -294,7 +401,7 @@ void MainWindow::loadSettings() {
 
   int size;
 
-  for (int i=0; i<xAxes.size()-1; i++)
+  while (xAxes.size() > 1)
     delX();
   size = localSettings->beginReadArray("xmotors");
   for (int i=0; i < size; i++) {
@@ -325,6 +432,14 @@ void MainWindow::loadSettings() {
       if (ok)
         ax->setPoints(val);
     }
+    if ( ! i && localSettings->contains("fly") )
+      ax->setFly( localSettings->value("fly").toBool() );
+    if ( ! i && localSettings->contains("flyTime") ) {
+      bool ok;
+      double val = localSettings->value("flyTime").toDouble(&ok);
+      if (ok)
+        ax->setFlyTime(val);
+    }
     if ( localSettings->contains("mode") )
       ax->setMode( localSettings->value("mode").toString() ) ;
 
@@ -337,9 +452,11 @@ void MainWindow::loadSettings() {
   ui->scan2D->setChecked(secDim);
   ui->ySet->setVisible(secDim);
   ui->ySet->setEnabled(secDim);
+  if ( localSettings->contains("snake") )
+    ui->snake->setChecked( localSettings->value("snake").toBool() );
 
-  for (int i=0; i<yAxes.size()-1; i++)
-    delX();
+  while (yAxes.size() > 1)
+    delY();
   size = localSettings->beginReadArray("ymotors");
   for (int i=0; i < size; i++) {
 
@@ -375,10 +492,53 @@ void MainWindow::loadSettings() {
   }
   localSettings->endArray();
 
+  while ( ! outerAxes.isEmpty() )
+    delOuter();
+  size = localSettings->beginReadArray("outermotors");
+  for (int i=0; i < size; i++) {
+
+    localSettings->setArrayIndex(i);
+    addOuter();
+    Axis * ax = outerAxes.last();
+
+    if ( localSettings->contains("pv") )
+      ax->motor->motor()->setPv(localSettings->value("pv").toString());
+    if ( localSettings->contains("start") ) {
+      bool ok;
+      double val = localSettings->value("start").toDouble(&ok);
+      if (ok)
+        ax->setStart(val);
+    }
+    if ( localSettings->contains("end") ) {
+      bool ok;
+      double val = localSettings->value("end").toDouble(&ok);
+      if (ok)
+        ax->setEnd(val);
+    }
+    if ( localSettings->contains("points") ) {
+      bool ok;
+      int val = localSettings->value("points").toInt(&ok);
+      if (ok)
+        ax->setPoints(val);
+    }
+    if ( localSettings->contains("mode") )
+      ax->setMode( localSettings->value("mode").toString() ) ;
+
+  }
+  localSettings->endArray();
+  if ( localSettings->contains("relaxY") )
+    ui->relaxY->setValue( localSettings->value("relaxY").toDouble() );
+  if ( localSettings->contains("relaxOuter") )
+    ui->relaxOuter->setValue( localSettings->value("relaxOuter").toDouble() );
+
   if ( localSettings->contains("afterScan") )
       ui->after->setCurrentIndex(
           ui->after->findText(
               localSettings->value("afterScan").toString() ) );
+  if ( localSettings->contains("pipeline") )
+    ui->pipeline->setChecked( localSettings->value("pipeline").toBool() );
+  if ( localSettings->contains("coordinated") )
+    ui->coordinated->setChecked( localSettings->value("coordinated").toBool() );
 
   if ( localSettings->contains("saveDir") )
     ui->saveDir->setText(localSettings->value("saveDir").toString());
@@ -388,6 +548,24 @@ void MainWindow::loadSettings() {
     ui->autoName->setChecked( localSettings->value("autoName").toBool() );
   if ( localSettings->contains("saveName") )
     ui->saveName->setText(localSettings->value("saveName").toString());
+  if ( localSettings->contains("persistentScripts") )
+    ui->persistentScripts->setChecked( localSettings->value("persistentScripts").toBool() );
+  if ( localSettings->contains("exposures") )
+    ui->exposures->setValue( localSettings->value("exposures").toInt() );
+  if ( localSettings->contains("targetError") )
+    ui->targetError->setValue( localSettings->value("targetError").toDouble() );
+  if ( localSettings->contains("dataFormat") )
+    ui->dataFormat->setCurrentIndex( qMax(0,
+        ui->dataFormat->findText( localSettings->value("dataFormat").toString() ) ) );
+  if ( localSettings->contains("flushInterval") )
+    ui->flushInterval->setValue( localSettings->value("flushInterval").toDouble() );
+  if ( localSettings->contains("flushRows") )
+    ui->flushRows->setValue( localSettings->value("flushRows").toInt() );
+  if ( localSettings->contains("pointListFile") )
+    ui->pointListFile->setText( localSettings->value("pointListFile").toString() );
+  if ( localSettings->contains("pointList") )
+    ui->pointList->setChecked( localSettings->value("pointList").toBool() );
+  loadPointList();
 
   updatePlots();
 
@@ -398,6 +576,26 @@ void MainWindow::loadSettings() {
   }
   localSettings->endArray();
 
+  if ( localSettings->contains("adaptive") )
+    ui->adaptive->setChecked( localSettings->value("adaptive").toBool() );
+  if ( localSettings->contains("adaptivePoints") )
+    ui->adaptivePoints->setValue( localSettings->value("adaptivePoints").toInt() );
+  if ( localSettings->contains("adaptiveTolerance") )
+    ui->adaptiveTolerance->setValue( localSettings->value("adaptiveTolerance").toDouble() );
+  if ( localSettings->contains("adaptiveSignal") )
+    ui->adaptiveSignal->setCurrentIndex( localSettings->value("adaptiveSignal").toInt() );
+
+  signalTimes.clear();
+  size = localSettings->beginReadArray("signalTimes");
+  for (int i = 0; i < size; ++i) {
+    localSettings->setArrayIndex(i);
+    bool ok;
+    const double val = localSettings->value("time").toDouble(&ok);
+    if (ok)
+      signalTimes[localSettings->value("signal").toString()] = val;
+  }
+  localSettings->endArray();
+
 }
 
 
@@ -407,6 +605,25 @@ void MainWindow::browseAutoSave(){
     ui->saveDir->setText(new_dir);
 }
 
+void MainWindow::browsePointList(){
+  QString new_file = QFileDialog::getOpenFileName(this, "Open point list", ui->pointListFile->text());
+  if ( ! new_file.isEmpty() ) {
+    ui->pointListFile->setText(new_file);
+    loadPointList();
+    storeSettings();
+  }
+}
+
+void MainWindow::loadPointList() {
+  pointListData.clear();
+  bool listOK = true;
+  if ( ui->pointList->isChecked() )
+    listOK = ScanEngine::readPointList(ui->pointListFile->text(), pointListData);
+  ui->pointListFile->setStyleSheet( listOK  ?  goodStyle  :  badStyle );
+  updatePlots();
+  checkReady();
+}
+
 QString MainWindow::prepareAutoSave() {
 
   QString dn = ui->saveDir->text();
@@ -476,11 +693,16 @@ void MainWindow::checkReady(){
   if ( ui->scan2D->isChecked() )
     foreach(Axis * ax, yAxes)
       iAmReady &= ax->isReady() ;
+  foreach(Axis * ax, outerAxes)
+    iAmReady &= ax->isReady() ;
   iAmReady &= (bool) signalsE.size();
+  if ( ui->pointList->isChecked() )
+    iAmReady &= ! pointListData.isEmpty();
   iAmReady &=
       ( ui->saveDir->styleSheet() == goodStyle ) &&
       ( ui->saveName->styleSheet() == goodStyle );
   ui->startStop->setEnabled(iAmReady || nowScanning() );
+  updateEstimate();
 }
 
 void MainWindow::constructSignalsLayout(){
@@ -507,34 +729,10 @@ void MainWindow::addSignal(const QString & pvName){
   connect(sg, SIGNAL(nameChanged(QString)), SLOT(updateHeaders()));
   connect(sg, SIGNAL(rightClicked(QPointF, double)), SLOT(reactSignalRightClick(QPointF, double)));
 
-  double xStart = ui->xAxis->start();
-  double xEnd = ui->xAxis->end();
-  if (ui->xAxis->mode() == Axis::REL) {
-    const double xInitPos = ui->xAxis->motor->motor()->getUserPosition();
-    xStart += xInitPos;
-    xEnd += xInitPos;
-  }
-
-  if ( ! ui->scan2D->isChecked() ) { // 2D
-    sg->setData(xAxisData.size(), xStart, xEnd);
-  } else { // 3D
-
-    double yStart = ui->yAxis->start();
-    double yEnd = ui->yAxis->end();
-    if (ui->yAxis->mode() == Axis::REL) {
-      const double yInitPos = ui->yAxis->motor->motor()->getUserPosition();
-      yStart += yInitPos;
-      yEnd += yInitPos;
-    }
-
-    sg->setData(xAxisData.size(), yAxisData.size(), xStart, xEnd, yStart, yEnd);
-
-  }
-
   ui->plots->addSubWindow(sg->plotWin)->showMaximized();
 
   constructSignalsLayout();
-  updatePlots();
+  updatePlots(); // sets the data of the new plot
 
 }
 
@@ -552,7 +750,7 @@ void MainWindow::reactSignalRightClick(const QPointF &point, double val) {
 
   contextMenu->actions().at(0)->setText( QString() +
         "Move motor" + ( ui->scan2D->isChecked() ? "s" : "") + " here: " + positionText);
-  contextMenu->actions().at(0)->setEnabled( ! nowScanning()  &&  (
+  contextMenu->actions().at(0)->setEnabled( ! nowScanning()  &&  ! ui->pointList->isChecked()  &&  (
                                         xAxes[0]->motor->motor()->isConnected()
       || ( ui->scan2D->isChecked()  &&  yAxes[0]->motor->motor()->isConnected()) ) );
   contextMenu->actions().at(1)->setText("Copy position: " + positionText);
@@ -619,6 +817,7 @@ void MainWindow::addX() {
   ui->delX->setEnabled(xAxes.size() > 1);
   xax->setPoints(ui->xAxis->points());
   xax->setPointsEnabled(false);
+  xax->setFlyAvailable(false);
 
   connect(xax, SIGNAL(statusChanged()), SLOT(checkReady()));
   connect(xax, SIGNAL(limitReached()), SLOT(stopScan()));
@@ -647,6 +846,7 @@ void MainWindow::addY() {
   ui->delY->setEnabled(yAxes.size() > 1);
   yax->setPoints(ui->yAxis->points());
   yax->setPointsEnabled(false);
+  yax->setFlyAvailable(false);
 
   connect(yax, SIGNAL(statusChanged()), SLOT(checkReady()));
   connect(yax, SIGNAL(limitReached()), SLOT(stopScan()));
@@ -667,6 +867,35 @@ void MainWindow::delY() {
   updatePlots();
 }
 
+void MainWindow::addOuter() {
+
+  Axis * oax = new Axis(this);
+  outerAxes << oax;
+  ui->outerLay->insertWidget(ui->outerLay->indexOf(ui->outerButtons), oax);
+  ui->delOuter->setEnabled(true);
+  oax->setFlyAvailable(false);
+
+  connect(oax, SIGNAL(statusChanged()), SLOT(checkReady()));
+  connect(oax, SIGNAL(limitReached()), SLOT(stopScan()));
+  connect(oax, SIGNAL(settingChanged()), SLOT(updatePlots()));
+  connect(oax, SIGNAL(settingChanged()), SLOT(storeSettings()));
+  connect(oax->motor->motor(), SIGNAL(changedPv(QString)), SLOT(storeSettings()));
+  connect(oax->motor->motor(), SIGNAL(changedPv(QString)), SLOT(updateHeaders()));
+
+  updatePlots();
+  storeSettings();
+
+}
+
+void MainWindow::delOuter() {
+  if (outerAxes.isEmpty())
+    return;
+  delete outerAxes.takeLast();
+  ui->delOuter->setEnabled( ! outerAxes.isEmpty() );
+  updatePlots();
+  storeSettings();
+}
+
 
 
 
@@ -676,12 +905,7 @@ void MainWindow::delY() {
 
 void MainWindow::switchDimension(bool secondDim){
 
-  if (secondDim) {
-    ui->dataTable->insertColumn(1);
-    ui->dataTable->setHorizontalHeaderItem(1, new QTableWidgetItem("Y Axis"));
-  } else {
-    ui->dataTable->removeColumn(1);
-  }
+  ui->adaptiveW->setEnabled( ! secondDim );
 
   checkReady();
 
@@ -697,13 +921,63 @@ void MainWindow::startStop(){
 
 
 void MainWindow::stopScan(){
-    stopNow=true;
-    if (nowScanning()) {
-      foreach (Axis * ax, xAxes)
-        ax->motor->motor()->stop();
-      foreach (Axis * ax, yAxes)
-        ax->motor->motor()->stop();
-    }
+    if (nowScanning())
+      engine->stop();
+}
+
+
+void MainWindow::pauseResume() {
+  if ( ! nowScanning() )
+    return;
+  const bool pause = ui->pauseResume->text() == "Pause";
+  QMetaObject::invokeMethod(engine, pause ? "pause" : "resume", Qt::QueuedConnection);
+  ui->pauseResume->setText( pause ? "Pausing..." : "Pause" );
+  ui->pauseResume->setEnabled( ! pause );
+}
+
+
+void MainWindow::onSignalTimed(const QString & name, double seconds) {
+  if ( signalTimes.contains(name) )
+    signalTimes[name] += 0.2 * ( seconds - signalTimes[name] );
+  else
+    signalTimes[name] = seconds;
+}
+
+
+static QString duration(double seconds) {
+  const qint64 secs = qRound64(seconds);
+  return QString("%1:%2:%3").arg(secs / 3600)
+      .arg(secs / 60 % 60, 2, 10, QChar('0'))
+      .arg(secs % 60, 2, 10, QChar('0'));
+}
+
+
+/// Shows the expected duration of the scan as it is set up now. The motors
+/// which are not connected and the signals never read before count as
+/// taking no time.
+void MainWindow::updateEstimate() {
+
+  if ( nowScanning() )
+    return;
+
+  ScanTimings tm;
+  foreach (Axis * ax, xAxes + yAxes + outerAxes) {
+    QCaMotor * mot = ax->motor->motor();
+    if ( ! mot->isConnected() )
+      continue;
+    tm.speed[mot->getPv()] = mot->getNormalSpeed();
+    tm.acceleration[mot->getPv()] = mot->getAcceleration();
+  }
+  tm.signalTime = signalTimes;
+
+  ui->estimate->setText("Estimated time: " + duration(ScanEngine::estimate(scanConfig(), tm)));
+
+}
+
+
+void MainWindow::onPaused(bool on) {
+  ui->pauseResume->setText( on ? "Resume" : "Pause" );
+  ui->pauseResume->setEnabled(true);
 }
 
 
@@ -735,10 +1009,9 @@ void MainWindow::openQti() {
         << sig->objectName() << " ";
   dataStr << "\n";
 
-  for ( int y = 0 ; y < ui->dataTable->rowCount(); y++ ) {
-    for ( int x = 0 ; x < ui->dataTable->columnCount() ; x++ )
-      dataStr << ( ui->dataTable->item(y,x) ?
-                   ui->dataTable->item(y,x)->text() : "NaN") << " ";
+  for ( int y = 0 ; y < scanData.rows(); y++ ) {
+    for ( int x = 0 ; x < scanData.columns() ; x++ )
+      dataStr << ( scanData.isSet(y,x) ? scanData.text(y, x, 15) : "NaN" ) << " ";
     dataStr << "\n";
   }
   dataFile.close();
@@ -749,259 +1022,245 @@ void MainWindow::openQti() {
 
 
 
-void describeAndPrepareAxis(Axis * ax, QTextStream & dataStr,
-                            QHash<Axis*, double> & initPos,
-                            QHash<Axis*, QPair<double,double> > & range) {
-
-  dataStr << "# PV: \"" << ax->motor->motor()->getPv() << "\"\n"
-          << "# Description: \"" << ax->motor->motor()->getDescription() << "\"\n";
+/// The scan as stored in the settings: the same reader as the headless
+/// mode uses. Only the point list comes from the one already loaded.
+ScanConfig MainWindow::scanConfig() {
 
-  const double init = ax->motor->motor()->getUserPosition();
-  initPos.insert(ax,init);
-  dataStr << "# Initial position: " << init << "\n";
-
-  double start = ax->start();
-  double end = ax->end();
-  if (ax->mode() == Axis::REL) {
-    start += init;
-    end += init;
+  ScanConfig cfg;
+  ScanEngine::readConfig(*localSettings, cfg, false);
+  if ( ui->pointList->isChecked() ) {
+    cfg.pointList = pointListData;
+    cfg.xPoints = xAxisData.size();
+    cfg.yPoints = 1;
   }
-  range.insert(ax, qMakePair(start, end));
-  dataStr << "# Scan range: " << start << " ... " << end << "\n"
-          << "#\n";
+  cfg.fileName = tableWasSavedTo;
+  return cfg;
 
 }
 
 
+void MainWindow::startScan(){
 
+  if (nowScanning())
+    return;
 
+  updatePlots();
 
+  // Data file
+  tableWasSavedTo = prepareAutoSave();
 
+  runScan(scanConfig());
 
+}
 
 
-
-void MainWindow::startScan(){
+/// Continues the scan interrupted in the data file chosen by the user.
+/// The scan must be set up the same way as it was when interrupted.
+void MainWindow::resumeScan() {
 
   if (nowScanning())
     return;
 
-  stopNow = false;
+  const QString fileName = QFileDialog::getOpenFileName(this, "Resume scan from the data file",
+                                                        ui->saveDir->text());
+  if ( fileName.isEmpty() )
+    return;
 
   updatePlots();
 
+  ScanConfig cfg = scanConfig();
+  QList<ScanPoint> done;
+  const QString problem = ScanEngine::resumeFile(fileName, cfg, done);
+  if ( ! problem.isEmpty() ) {
+    warn("Can not resume the scan from \"" + fileName + "\": " + problem, this);
+    return;
+  }
+
+  tableWasSavedTo = cfg.fileName;
+  ui->progressBar->setMaximum(cfg.totalPoints());
+  foreach (const ScanPoint & pt, done)
+    onPointDone(pt);
+  runScan(cfg);
+
+}
+
+
+void MainWindow::runScan(const ScanConfig & cfg) {
+
   ui->setup->setEnabled(false);
   ui->startStop->setText("Stop");
-
-  // Data file
-  tableWasSavedTo = prepareAutoSave();
-  QFile dataFile(tableWasSavedTo);
-  dataFile.open(QIODevice::Truncate | QIODevice::WriteOnly);
-  QTextStream dataStr(&dataFile);
+  ui->pauseResume->setText("Pause");
+  ui->pauseResume->setEnabled(true);
+  ui->resumeScan->setEnabled(false);
 
   // buttons
   ui->saveResult->setEnabled(true);
   ui->qtiResults->setEnabled(true);
 
-  dataStr
-      << "# ScanMX\n"
-      << "#\n"
-      << "# Date: " << QDate::currentDate().toString() << "\n"
-      << "# Time: " << QTime::currentTime().toString() << "\n"
-      << "#\n";
-
-  //sizes
-  const int xPoints = xAxisData.size();
-  const int yPoints = yAxisData.size();
-  const int totalPoints = xPoints * yPoints;
-
-  dataStr
-      << "# " << (ui->scan2D->isChecked() ? "2" : "1") << "D scan\n"
-      << "# Number of data points: " << totalPoints << "\n";
-  if ( ui->scan2D->isChecked() )
-    dataStr
-        << "# Number of X axis points: " << xPoints << "\n"
-        << "# Number of Y axis points: " << yPoints << "\n"
-        << "#\n";
-  dataStr << "#\n";
+  // reset progress
+  ui->progressBar->setMaximum(cfg.totalPoints());
+  ui->progressBar->setValue(cfg.resumeFrom);
+  scanFrom = cfg.resumeFrom;
+  scanClock.start();
 
-  QHash<Axis*,double> initPos;
-  QHash<Axis*, QPair<double,double> > range;
+  QMetaObject::invokeMethod(engine, "start", Qt::QueuedConnection, Q_ARG(ScanConfig, cfg));
 
+}
 
-  dataStr << "# Number of X motors:" << xAxes.size() << "\n";
-  foreach (Axis * ax, xAxes) {
-    if (xAxes.size() > 1)
-      dataStr << "# X axis, motor " << xAxes.indexOf(ax) << "\n";
-    else
-      dataStr << "# X axis\n";
-    describeAndPrepareAxis(ax, dataStr, initPos, range);
-  }
 
-  if ( ui->scan2D->isChecked() ) {
-    foreach (Axis * ax, yAxes) {
-      if (yAxes.size() > 1)
-        dataStr << "# Y axis, motor " << yAxes.indexOf(ax) << "\n";
-      else
-        dataStr << "# Y axis\n";
-      describeAndPrepareAxis(ax, dataStr, initPos, range);
-    }
+/// Loads the configuration file into the setup.
+void MainWindow::applyConfig(const QString & fileName) {
+  const QHash<QString,double> times = signalTimes; // measured here, not in the file
+  QSettings entry(fileName, QSettings::IniFormat);
+  nowLoading = true;
+  localSettings->clear();
+  foreach (const QString & key, entry.allKeys())
+    localSettings->setValue(key, entry.value(key));
+  while ( ! signalsE.isEmpty() ) // loadSettings() only adds them
+    delete signalsE.takeLast();
+  loadSettings();
+  nowLoading = false;
+  signalTimes = times;
+  storeSettings();
+}
+
+
+void MainWindow::queueCurrent() {
+  const QString fileName = QFileDialog::getSaveFileName(this, "Save the setup for the queue",
+                                                        ui->saveDir->text());
+  if ( fileName.isEmpty() )
+    return;
+  storeSettings();
+  localSettings->sync();
+  QFile::remove(fileName);
+  if ( ! QFile::copy(localSettings->fileName(), fileName) ) {
+    warn("Could not save the setup into \"" + fileName + "\".", this);
+    return;
   }
+  ui->queue->addItem(fileName);
+}
 
-  dataStr << "#\n"
-          << "#\n"
-          << "# Signals:\n"
-          << "#\n";
-  foreach (Signal * sig, signalsE)
-    dataStr
-        << "# PV / script: \"" << sig->objectName() << "\"\n";
-  dataStr << "#\n";
 
-  // reset progress
-  ui->progressBar->setMaximum(totalPoints);
-
-  dataStr
-      << "# Data columns:\n"
-      << "# "
-      << "%Point "
-      << "%X "
-      << ( ui->scan2D->isChecked() ? "%Y " : "" );
-  foreach (Signal * sig, signalsE)
-    dataStr
-        << "%" << sig->objectName() << " ";
-  dataStr << "\n";
+void MainWindow::queueFile() {
+  ui->queue->addItems( QFileDialog::getOpenFileNames(this, "Add scan configurations to the queue",
+                                                     ui->saveDir->text()) );
+}
 
 
+void MainWindow::queueRemove() {
+  qDeleteAll(ui->queue->selectedItems());
+}
 
-  ////////////////
-  // doing scan //
-  ////////////////
-  int curpoint = 0;
-  for( int ypoint = 0 ; ypoint < yPoints ; ypoint++ ) {
-
-    QHash<Axis*,double> yPos;
-    if ( ui->scan2D->isChecked() ) {
-
-      setenv("YPOINT", QString::number(ypoint).toLatin1(), 1);
-      yPos.clear();
-      foreach(Axis * ax, yAxes)
-        ax->motor->motor()->goUserPosition
-            ( range[ax].first +
-              ( ypoint * ( range[ax].second - range[ax].first ) ) / (yPoints - 1),
-              QCaMotor::STARTED );
-      foreach(Axis * ax, yAxes) {
-        ax->motor->motor()->wait_stop();
-        if ( ax->motor->motor()->getLoLimitStatus() ||
-             ax->motor->motor()->getHiLimitStatus() )
-          dataStr <<  "# Y Axis: " + ax->motor->motor()->getPv() + " limit hit.\n";
-        yPos[ax] = ax->motor->motor()->getUserPosition();
-      }
-
-      if (ui->relaxY->value() != 0.0 ) {
-        qtWait(ui->startStop, SIGNAL(clicked()), ui->relaxY->value() * 1000 ); // relaxation must finish on start/stop clicked
-        QApplication::processEvents(); // if start/stop was clicked the stopNow must be updated in here
-      }
-
-      updateGUI();
-      if ( stopNow )
-        break;
 
-    }
+void MainWindow::runQueue() {
+  if ( nowScanning()  ||  ! ui->queue->count() )
+    return;
+  queueRunning = true;
+  ui->queueRun->setEnabled(false);
+  nextInQueue();
+}
 
-    QHash<Axis*,double> xPos;
-    for( int xpoint = 0 ; xpoint < xPoints ; xpoint++ ) {
-
-      setenv("XPOINT", QString::number(xpoint).toLatin1(), 1);
-      ui->dataTable->insertRow(curpoint);
-      ui->dataTable->setVerticalHeaderItem(curpoint,
-                                           new QTableWidgetItem(QString::number(curpoint+1)));
-      ui->dataTable->scrollToBottom();
-
-      xPos.clear();
-      foreach(Axis * ax, xAxes)
-        ax->motor->motor()->goUserPosition
-            ( range[ax].first +
-              ( xpoint * ( range[ax].second - range[ax].first ) ) / (xPoints - 1),
-              QCaMotor::STARTED );
-      foreach(Axis * ax, xAxes) {
-        ax->motor->motor()->wait_stop();
-        if ( ax->motor->motor()->getLoLimitStatus() ||
-             ax->motor->motor()->getHiLimitStatus() )
-          dataStr <<  "# X Axis: " + ax->motor->motor()->getPv() + " limit hit.\n";
-        xPos[ax] = ax->motor->motor()->getUserPosition();
-      }
-
-      /*
-      if (ui->relax->value() != 0.0 ) {
-        qtWait(ui->startStop, SIGNAL(clicked()), ui->relax->value() * 1000 ); // relaxation must finish on start/stop clicked
-        QApplication::processEvents(); // if start/stop was clicked the stopNow must be updated in here
-      }
-      */
-
-      if ( ! ui->scan2D->isChecked() )
-        xAxisData[xpoint] = xPos[ui->xAxis];
-
-      updateGUI();
-      if ( stopNow )
-        break;
-
-      dataStr << curpoint+1 << " ";
-      foreach(Axis * ax, xAxes) {
-        ui->dataTable->setItem(curpoint, columns[ax],
-                               new QTableWidgetItem(QString::number(xPos[ax])));
-        dataStr << QString::number(xPos[ax], 'e') << " ";
-      }
-      if ( ui->scan2D->isChecked() )
-        foreach(Axis * ax, yAxes) {
-          ui->dataTable->setItem(curpoint, columns[ax],
-                                 new QTableWidgetItem(QString::number(yPos[ax])));
-          dataStr << QString::number(yPos[ax], 'e') << " ";
-        }
-
-      updateGUI();
-      foreach(Signal * sig, signalsE)
-        sig->beforeGet();
-      foreach(Signal * sig, signalsE) {
-        QString strval = sig->get(curpoint).toString();
-        ui->dataTable->setItem(curpoint, columns[sig],
-                               new QTableWidgetItem(strval));
-        dataStr << strval << " ";
-      }
-      dataStr <<  "\n";
-
-      ui->progressBar->setValue(++curpoint);
-      updateGUI();
-
-      if ( stopNow )
-        break;
 
-    }
+/// Starts the first scan in the queue. The engine keeps its motors and
+/// signals between the scans, so the PVs shared by the queued scans stay
+/// connected.
+void MainWindow::nextInQueue() {
+  if ( ! queueRunning  ||  nowScanning() )
+    return;
+  QListWidgetItem * item = ui->queue->takeItem(0);
+  if ( ! item ) {
+    queueRunning = false;
+    ui->queueRun->setEnabled(true);
+    return;
+  }
+  const QString fileName = item->text();
+  delete item;
+  if ( ! QFile::exists(fileName) ) {
+    warn("Queued configuration \"" + fileName + "\" does not exist. Skipped.", this);
+    QTimer::singleShot(0, this, SLOT(nextInQueue()));
+    return;
+  }
+  applyConfig(fileName);
+  startScan();
+}
+
+
+void MainWindow::onPointDone(const ScanPoint & pt) {
+
+  // position in the grid, not in the acquisition order (they differ in the snake scan)
+  const int sliceSize = xAxisData.size() * yAxisData.size();
+  const int curpoint = pt.slice * sliceSize + pt.ypoint * xAxisData.size() + pt.xpoint;
 
-    if ( stopNow )
-      break;
+  table->grow(curpoint + 1);
 
+  for (int i = 0 ; i < pt.xPos.size() && i < xAxes.size() ; i++)
+    scanData.set(curpoint, columns[xAxes[i]], pt.xPos[i]);
+  if ( ui->scan2D->isChecked() )
+    for (int i = 0 ; i < pt.yPos.size() && i < yAxes.size() ; i++)
+      scanData.set(curpoint, columns[yAxes[i]], pt.yPos[i]);
+
+  for (int i = 0 ; i < pt.outerPos.size() && i < outerAxes.size() ; i++)
+    scanData.set(curpoint, columns[outerAxes[i]], pt.outerPos[i]);
+
+  if ( ! ui->scan2D->isChecked() && ! ui->pointList->isChecked()
+       && ! pt.xPos.isEmpty() && pt.xpoint < xAxisData.size() )
+    xAxisData[pt.xpoint] = pt.xPos[0];
+
+  // plots follow the scan into the next slice unless an earlier one is viewed
+  if ( ui->slice->value() == pt.slice )
+    ui->slice->setValue(pt.slice + 1);
+  const bool shown = ui->slice->value() == pt.slice + 1;
+
+  for (int i = 0 ; i < pt.values.size() && i < signalsE.size() ; i++) {
+    Signal * sig = signalsE[i];
+    scanData.set(curpoint, columns[sig], pt.values[i]);
+    if ( i < pt.errors.size() )
+      scanData.setError(curpoint, columns[sig], pt.errors[i], pt.count);
+    if (shown)
+      sig->record(curpoint - pt.slice * sliceSize, pt.xPos.value(0, NAN), pt.values[i]);
   }
 
+  table->rowChanged(curpoint);
+  ui->dataTable->scrollTo(table->index(curpoint, 0));
+  ui->progressBar->setValue(pt.index+1);
+
+  // remaining time at the pace of the scan so far
+  if ( nowScanning()  &&  pt.index >= scanFrom ) {
+    const double pace = scanClock.elapsed() / 1000.0 / ( pt.index + 1 - scanFrom );
+    ui->estimate->setText("Remaining: "
+                          + duration( pace * ( ui->progressBar->maximum() - pt.index - 1 ) ));
+  }
+
+}
 
-  dataStr << (stopNow ? "# Stopped unfinished" : "# All done") << ".\n";
-  dataFile.close();
 
-  // after scan positioning
-  foreach (Axis * ax, xAxes + ( ui->scan2D->isChecked() ? yAxes : QList<Axis*>() ) )
-    if ( ui->after->currentText() == "Start position" )
-      ax->motor->motor()->goUserPosition(range[ax].first, QCaMotor::STARTED);
-    else if ( ui->after->currentText() == "Prior position" )
-      ax->motor->motor()->goUserPosition(initPos[ax], QCaMotor::STARTED);
+/// Shows the data of the outer levels point _sliceNo_ (from 1) in the plots.
+void MainWindow::showSlice(int sliceNo) {
+  const int sliceSize = xAxisData.size() * yAxisData.size();
+  foreach (Signal * sig, signalsE)
+    sig->showFrom( (sliceNo - 1) * sliceSize );
+}
 
-  foreach (Axis * ax, xAxes + ( ui->scan2D->isChecked() ? yAxes : QList<Axis*>() ) )
-    ax->motor->motor()->wait_stop();
+
+void MainWindow::onScanFinished(bool stopped) {
 
   // finishing
   ui->startStop->setText("Start");
+  ui->pauseResume->setText("Pause");
+  ui->pauseResume->setEnabled(false);
+  ui->resumeScan->setEnabled(true);
   ui->setup->setEnabled(true);
+  storeSettings(); // signal timings
 
-  emit scanComplete();
+  if (queueRunning) {
+    if (stopped)
+      queueRunning = false;
+    else
+      QTimer::singleShot(0, this, SLOT(nextInQueue()));
+  }
+  ui->queueRun->setEnabled( ! queueRunning );
 
+  emit scanComplete();
 
 }
 
@@ -1031,7 +1290,8 @@ MainWindow::Signal::Signal(QWidget* parent) :
   plotWin(new QMdiSubWindow(parent)),
   scr(new Script(this)),
   pv(new QEpicsPv(this)),
-  graph(new Graph)
+  graph(new Graph),
+  refined(false)
 {
 
   sig->setEditable(true);
@@ -1070,63 +1330,33 @@ MainWindow::Signal::~Signal() {
   delete plotWin;
 };
 
-void MainWindow::Signal::beforeGet() {
-  if (pv->isConnected())
-    pv->needUpdated();
-}
-
-
-QVariant MainWindow::Signal::get(int pos) {
-
-  QVariant val=QVariant();
-
-  if (pv->isConnected()) {
-
-    if ( ! pv->isConnected() )
-      return val;
-
-    val = pv->getUpdated();
-    if ( ! val.isValid() )
-      val = pv->get();
-
-  } else {
-
-    if ( ! scr->start() )
-      return val;
-    scr->waitStop();
-
-    val = scr->out();
-
+/// The value is already in the ScanData the plot reads.
+void MainWindow::Signal::record(int pos, double x, const QString & strval) {
+  double rval = strval.toDouble();
+  if ( pos >= 0 && pos < size && ! refined ) {
+    graph->updateData(pos, rval);
+  } else if ( pos >= (int) size ) { // refinement of the adaptive scan beyond the grid
+    graph->insertPoint(x, rval);
+    refined = true; // the line keeps its own values from here on
   }
-
-  if ( pos >= 0 && pos < size ) {
-    double rval = val.toDouble();
-    *(data + pos) = rval;
-    graph->updateData(rval);
-  }
-
-  return val;
-
 }
 
-void MainWindow::Signal::setData(int width, double xStart, double xEnd) {
+void MainWindow::Signal::setData(const ScanData * store, int column,
+                                 int width, double xStart, double xEnd) {
   point = 0;
+  refined = false;
   size = width;
-  QVector<double> dd;
-  dd.resize(size);
-  dd.fill(NAN);
-  data = graph->changePlot(dd, xStart, xEnd);
+  graph->changePlot(store, column, size, xStart, xEnd);
 }
 
-void MainWindow::Signal::setData(int width, int height,
-                    double xStart, double xEnd,
-                    double yStart, double yEnd) {
+void MainWindow::Signal::setData(const ScanData * store, int column,
+                                 int width, int height,
+                                 double xStart, double xEnd,
+                                 double yStart, double yEnd) {
   point = 0;
+  refined = false;
   size=width*height;
-  QVector<double> dd;
-  dd.resize(size);
-  dd.fill(NAN);
-  data = graph->changePlot(dd, width, xStart, xEnd, yStart, yEnd);
+  graph->changePlot(store, column, size, width, xStart, xEnd, yStart, yEnd);
 }
 
 
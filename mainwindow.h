@@ -7,7 +7,7 @@
 #include <QLabel>
 #include <QList>
 #include <QHash>
-#include <QTableWidget>
+#include <QTableView>
 #include <QCheckBox>
 #include <QDebug>
 #include <QSettings>
@@ -16,24 +16,41 @@
 #include <QCursor>
 #include <QProcess>
 #include <QComboBox>
+#include <QThread>
+#include <QElapsedTimer>
 #include <qcamotorgui.h>
 #include <poptmx.h>
 
 #include "graph.h"
 #include "axis.h"
 #include "script.h"
+#include "scanengine.h"
+#include "datamodel.h"
 
 
 namespace Ui {
     class MainWindow;
 }
 
+
+/// Command line arguments.
+struct clargs {
+  std::string command;
+  bool start;
+  bool headless;
+  std::string config;
+  poptmx::OptionTable table;
+  clargs(int argc, char *argv[]);
+};
+
+
 class MainWindow : public QMainWindow {
     Q_OBJECT;
 
 public:
 
     MainWindow(int argc, char *argv[], QWidget *parent = 0);
+    ~MainWindow();
 
 private:
 
@@ -52,13 +69,19 @@ private:
 
     QList<Axis*> xAxes;
     QList<Axis*> yAxes;
+    QList<Axis*> outerAxes; ///< one per outer level, innermost first
 
     QHash<QObject*,int> columns; // QWidget: Signal or Axis
+    ScanData scanData;   ///< the only copy of the data: table, plots and exports read it
+    DataModel * table;
 
 
     QString tableWasSavedTo;
 
-    bool stopNow;
+    QThread engineThread;
+    ScanEngine * engine;
+    ScanConfig scanConfig();
+    void runScan(const ScanConfig & cfg);
 
 
     class Signal;
@@ -71,16 +94,38 @@ private:
 
     QVector<double> xAxisData;
     QVector<double> yAxisData;
+    QList< QVector<double> > pointListData;
+
+    QHash<QString,double> signalTimes; ///< rolling mean read time of the signals, s
+    QElapsedTimer scanClock;
+    int scanFrom;                      ///< first point acquired in this run (resumed scan)
+
+    bool queueRunning;
+    void applyConfig(const QString & fileName);
 
 private slots:
 
     void browseAutoSave();
+    void browsePointList();
+    void loadPointList();
     QString prepareAutoSave();
     void printResult();
     void saveResult();
     void startStop();
     void startScan();
     void stopScan();
+    void pauseResume();
+    void onPaused(bool on);
+    void onSignalTimed(const QString & name, double seconds);
+    void updateEstimate();
+    void queueCurrent();
+    void queueFile();
+    void queueRemove();
+    void runQueue();
+    void nextInQueue();
+    void resumeScan();
+    void onPointDone(const ScanPoint & pt);
+    void onScanFinished(bool stopped);
     void addSignal(const QString & pvName="");
     void removeSignal();
     void switchDimension(bool secondDim);
@@ -92,6 +137,9 @@ private slots:
     void delX();
     void addY();
     void delY();
+    void addOuter();
+    void delOuter();
+    void showSlice(int sliceNo);
 
     void reactSignalRightClick(const QPointF & point, double val);
 
@@ -149,26 +197,26 @@ private:
   Script * scr;
   QEpicsPv * pv;
 
-  double * data;
   size_t size;
   Graph * graph;
   static CloseFilter * closeFilt;
   int point;
+  bool refined;
 
 public:
 
   Signal(QWidget* parent=0);
   ~Signal();
 
-  void setData(int width, double xStart, double xEnd);
-  void setData(int width, int height,
+  void setData(const ScanData * store, int column, int width, double xStart, double xEnd);
+  void setData(const ScanData * store, int column, int width, int height,
                double xStart, double xEnd,
                double yStart, double yEnd);
 
   inline void print(QPrinter & printer) {graph->print(printer);}
 
-  void beforeGet();
-  QVariant get(int pos=-1);
+  void record(int pos, double x, const QString & strval);
+  inline void showFrom(int offset) {graph->setOffset(offset);}
 
 private slots:
 
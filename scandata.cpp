@@ -0,0 +1,80 @@
+#include "scandata.h"
+#include <cmath>
+
+
+ScanData::ScanData()
+  : nrows(0)
+{
+}
+
+
+void ScanData::reset(int columns) {
+  nrows = 0;
+  values.clear();
+  values.resize(columns);
+  texts.clear();
+  texts.resize(columns);
+  errors.clear();
+  errors.resize(columns);
+  counts.clear();
+}
+
+
+void ScanData::grow(int rows) {
+  if ( rows <= nrows )
+    return;
+  for (int col = 0 ; col < values.size() ; col++) {
+    values[col].insert(nrows, rows - nrows, NAN);
+    if ( ! errors[col].isEmpty() )
+      errors[col].insert(nrows, rows - nrows, NAN);
+  }
+  if ( ! counts.isEmpty() )
+    counts.insert(nrows, rows - nrows, 0);
+  nrows = rows;
+}
+
+
+void ScanData::set(int row, int col, double value) {
+  if ( row < 0  ||  row >= nrows  ||  col < 0  ||  col >= values.size() )
+    return;
+  values[col][row] = value;
+  if ( isnan(value) )
+    texts[col][row] = "nan";
+  else
+    texts[col].remove(row);
+}
+
+
+void ScanData::set(int row, int col, const QString & value) {
+  bool ok;
+  const double val = value.toDouble(&ok);
+  if (ok) {
+    set(row, col, val);
+  } else if ( row >= 0  &&  row < nrows  &&  col >= 0  &&  col < values.size() ) {
+    values[col][row] = NAN;
+    texts[col][row] = value;
+  }
+}
+
+
+void ScanData::setError(int row, int col, double error, int count) {
+  if ( row < 0  ||  row >= nrows  ||  col < 0  ||  col >= errors.size() )
+    return;
+  if ( errors[col].isEmpty() )
+    errors[col].fill(NAN, nrows);
+  if ( counts.isEmpty() )
+    counts.fill(0, nrows);
+  errors[col][row] = error;
+  counts[row] = count;
+}
+
+
+bool ScanData::isSet(int row, int col) const {
+  return ! isnan(values[col][row])  ||  texts[col].contains(row);
+}
+
+
+QString ScanData::text(int row, int col, int precision) const {
+  const double val = values[col][row];
+  return isnan(val)  ?  texts[col].value(row)  :  QString::number(val, 'g', precision);
+}
@@ -0,0 +1,55 @@
+#ifndef SCANDATA_H
+#define SCANDATA_H
+
+#include <QVector>
+#include <QHash>
+#include <QString>
+#include <cmath>
+
+
+/// Data of the scan: one column of doubles per axis readback and signal.
+///
+/// This is the only copy of the data in the GUI: the table model, the plots
+/// and the exports all read from it. Signals which are not numbers keep
+/// their text. Cells never set are NaN and have no text.
+class ScanData {
+
+public:
+
+  ScanData();
+
+  /// Drops all the data.
+  void reset(int columns);
+  /// Appends empty rows up to _rows_.
+  void grow(int rows);
+
+  inline int rows() const { return nrows; }
+  inline int columns() const { return values.size(); }
+
+  void set(int row, int col, double value);
+  void set(int row, int col, const QString & value);
+  /// Averaged point: standard deviation of the signal and the number of readings.
+  void setError(int row, int col, double error, int count);
+
+  bool isSet(int row, int col) const;
+  /// NaN outside the data.
+  inline double value(int row, int col) const {
+    return row >= 0  &&  row < nrows  ?  values[col][row]  :  NAN;
+  }
+  QString text(int row, int col, int precision = 6) const;
+  inline bool hasErrors(int col) const { return ! errors[col].isEmpty(); }
+  inline double error(int row, int col) const { return errors[col][row]; }
+  inline int count(int row) const { return counts.value(row); }
+
+private:
+
+  int nrows;
+  QVector< QVector<double> > values;   ///< per column; NaN where not set or not a number
+  QVector< QHash<int,QString> > texts; ///< per column: cells which are NaN or not numbers
+  QVector< QVector<double> > errors;   ///< per column, allocated on the first error
+  QVector<int> counts;                 ///< per row, allocated on the first error
+
+};
+
+
+#endif // SCANDATA_H
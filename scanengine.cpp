@@ -0,0 +1,2084 @@
+#include "scanengine.h"
+#include "error.h"
+#include "binaryscan.h"
+#include <QFile>
+#include <QTextStream>
+#include <QDate>
+#include <QTime>
+#include <QElapsedTimer>
+#include <QRegExp>
+#include <stdlib.h>
+#include <cmath>
+#include <algorithm>
+
+
+
+const int ScanEngine::Detector::updateTimeout = 1000;
+
+
+ScanEngine::Detector::Detector(const QString & name, QObject * parent)
+  : QObject(parent)
+  , pv(new QEpicsPv(this))
+  , scr(new Script(this))
+  , fresh(true)
+  , mode(IDLE)
+  , took(-1)
+  , updateTimer(this)
+{
+  pv->setPV(name);
+  scr->setPath(name);
+  updateTimer.setSingleShot(true);
+  updateTimer.setInterval(updateTimeout);
+  connect(pv, SIGNAL(valueUpdated(QVariant)), SLOT(onUpdated()));
+  connect(&updateTimer, SIGNAL(timeout()), SLOT(onUpdated()));
+  connect(scr, SIGNAL(finished(int)), SLOT(onFinished()));
+  connect(scr, SIGNAL(answered()), SLOT(onAnswered()));
+}
+
+
+/// Starts the acquisition: waits for the next update of the PV or launches the script.
+/// With _latest_ the PV is not waited for: its latest monitored value is
+/// taken (used for the continuous sampling in the fly scan).
+/// A persistent script is sent the _request_ line instead of being launched.
+/// The done() signal is emitted when the value is ready, but not from here:
+/// check isDone() after the call.
+void ScanEngine::Detector::trigger(bool latest, const QString & request) {
+  cancel();
+  val = QVariant();
+  took = -1;
+  clock.start();
+  if (pv->isConnected()) {
+    if (latest) {
+      val = pv->get();
+    } else {
+      mode = UPDATE;
+      updateTimer.start(); // no update: the current value is taken
+    }
+  } else if (scr->isPersistent()) {
+    if ( scr->request(request) )
+      mode = ASKED;
+  } else if ( scr->start() ) {
+    mode = STARTED;
+  }
+}
+
+
+void ScanEngine::Detector::cancel() {
+  updateTimer.stop();
+  if (mode == STARTED)
+    scr->stop();
+  mode = IDLE;
+}
+
+
+void ScanEngine::Detector::onUpdated() {
+  if (mode != UPDATE)
+    return;
+  updateTimer.stop();
+  val = pv->get();
+  mode = IDLE;
+  took = clock.elapsed() / 1000.0;
+  emit done();
+}
+
+
+void ScanEngine::Detector::onFinished() {
+  if (mode == STARTED)
+    val = scr->out();
+  else if (mode != ASKED) // persistent script died before the answer
+    return;
+  mode = IDLE;
+  took = clock.elapsed() / 1000.0;
+  emit done();
+}
+
+
+void ScanEngine::Detector::onAnswered() {
+  if (mode != ASKED)
+    return;
+  val = scr->out();
+  mode = IDLE;
+  took = clock.elapsed() / 1000.0;
+  emit done();
+}
+
+
+
+ScanEngine::Writer::Writer(QObject * parent)
+  : QObject(parent)
+  , flushTimer(this)
+  , pending(0)
+  , flushRows(0)
+{
+  flushTimer.setSingleShot(true);
+  connect(&flushTimer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+
+void ScanEngine::Writer::open(const QString & fileName, bool append,
+                              double flushInterval, int _flushRows) {
+  close();
+  file.setFileName(fileName);
+  if ( ! file.open( ( append ? QIODevice::Append : QIODevice::Truncate ) | QIODevice::WriteOnly ) )
+    warn("Could not open data file \"" + fileName + "\": " + file.errorString() + ".", this);
+  str.setDevice(&file);
+  flushTimer.setInterval( qMax(0, int(1000 * flushInterval)) );
+  flushRows = _flushRows;
+}
+
+
+/// The text goes to the disk once flushRows lines are pending or once
+/// the flush interval passes after the first of them.
+void ScanEngine::Writer::write(const QString & text, int rows) {
+  if ( ! file.isOpen() )
+    return;
+  str << text;
+  pending += rows;
+  if ( flushRows > 0  &&  pending >= flushRows )
+    flush();
+  else if ( ! flushTimer.isActive() )
+    flushTimer.start();
+}
+
+
+void ScanEngine::Writer::writeRaw(const QByteArray & bytes, int rows) {
+  if ( ! file.isOpen() )
+    return;
+  str.flush();
+  file.write(bytes);
+  pending += rows;
+  if ( flushRows > 0  &&  pending >= flushRows )
+    flush();
+  else if ( ! flushTimer.isActive() )
+    flushTimer.start();
+}
+
+
+void ScanEngine::Writer::flush() {
+  flushTimer.stop();
+  pending = 0;
+  if ( ! file.isOpen() )
+    return;
+  str.flush();
+  file.flush();
+}
+
+
+void ScanEngine::Writer::close() {
+  flush();
+  file.close();
+}
+
+
+
+const int ScanEngine::connectionTimeout = 2000;
+const int ScanEngine::motionStartTimeout = 500;
+const int ScanEngine::flySamplesPerPoint = 4;
+const int ScanEngine::orderingTime = 1000;
+
+
+ScanEngine::ScanEngine(QObject * parent)
+  : QObject(parent)
+  , scanning(0)
+  , stopNow(0)
+  , state(IDLE)
+  , pausing(false)
+  , proceed(0)
+  , timer(this)
+  , motionTimer(this)
+  , slice(0)
+  , outerRelax(0)
+  , curpoint(0)
+  , ypoint(0)
+  , step(0)
+  , prefetched(false)
+  , resumeY(0)
+  , resumeStep(0)
+  , refining(false)
+  , refineAt(0)
+  , exposure(0)
+  , dataWriter(new Writer)
+  , flyWriter(new Writer)
+  , binWriter(new Writer)
+  , binOut(false)
+  , flyRaw(false)
+  , sampling(false)
+  , sampleStart(0)
+{
+  setObjectName("ScanEngine");
+  registerMetaTypes();
+  dataStr.setString(&dataBuf);
+  flyStr.setString(&flyBuf);
+  dataWriter->moveToThread(&writerThread);
+  flyWriter->moveToThread(&writerThread);
+  binWriter->moveToThread(&writerThread);
+  writerThread.start();
+  timer.setSingleShot(true);
+  motionTimer.setSingleShot(true);
+  motionTimer.setInterval(motionStartTimeout);
+  connect(&timer, SIGNAL(timeout()), SLOT(onTimer()));
+  connect(&motionTimer, SIGNAL(timeout()), SLOT(onMotionStartTimeout()));
+}
+
+
+ScanEngine::~ScanEngine() {
+  // whatever is still in the writers goes to the disk
+  QMetaObject::invokeMethod(dataWriter, "close", Qt::BlockingQueuedConnection);
+  QMetaObject::invokeMethod(flyWriter, "close", Qt::BlockingQueuedConnection);
+  QMetaObject::invokeMethod(binWriter, "close", Qt::BlockingQueuedConnection);
+  writerThread.quit();
+  writerThread.wait();
+  delete dataWriter;
+  delete flyWriter;
+  delete binWriter;
+  qDeleteAll(detectors);
+  qDeleteAll(motors);
+}
+
+
+void ScanEngine::registerMetaTypes() {
+  qRegisterMetaType<ScanAxis>("ScanAxis");
+  qRegisterMetaType<ScanLevel>("ScanLevel");
+  qRegisterMetaType<ScanConfig>("ScanConfig");
+  qRegisterMetaType<ScanPoint>("ScanPoint");
+}
+
+
+/// Lines are the points, the positions are separated by commas, semicolons
+/// or spaces. Empty lines, comments (#) and a non-numeric header line are
+/// skipped.
+bool ScanEngine::readPointList(const QString & fileName, QList< QVector<double> > & points) {
+
+  points.clear();
+  QFile file(fileName);
+  if ( ! file.open(QIODevice::ReadOnly | QIODevice::Text) ) {
+    warn("Could not open point list \"" + fileName + "\".");
+    return false;
+  }
+
+  const QRegExp separator("[,;\\s]+");
+  int lineNo = 0;
+  while ( ! file.atEnd() ) {
+    const QString line = QString(file.readLine()).trimmed();
+    lineNo++;
+    if ( line.isEmpty()  ||  line.startsWith('#') )
+      continue;
+    QVector<double> pos;
+    bool ok = true;
+    foreach (const QString & field, line.split(separator, QString::SkipEmptyParts)) {
+      pos << field.toDouble(&ok);
+      if ( ! ok )
+        break;
+    }
+    if ( ! ok  &&  points.isEmpty() ) // header
+      continue;
+    if ( ! ok ) {
+      warn("Bad position in line " + QString::number(lineNo) + " of the point list \""
+           + fileName + "\".");
+      points.clear();
+      return false;
+    }
+    points << pos;
+  }
+
+  return ! points.isEmpty();
+
+}
+
+
+static ScanAxis readAxis(QSettings & settings) {
+  return ScanAxis( settings.value("pv").toString(),
+                   settings.value("start", 0.0).toDouble(),
+                   settings.value("end", 0.0).toDouble(),
+                   settings.value("mode").toString() == "Relative" );
+}
+
+
+/// The keys are those written by MainWindow::storeSettings(); the GUI
+/// builds its scans from them too, so the queued and the headless scans
+/// are the same as the ones started from the window.
+QString ScanEngine::readConfig(QSettings & settings, ScanConfig & cfg, bool readList) {
+
+  cfg = ScanConfig();
+
+  int size = settings.beginReadArray("xmotors");
+  for (int i = 0 ; i < size ; i++) {
+    settings.setArrayIndex(i);
+    cfg.xAxes << readAxis(settings);
+    if ( ! i ) {
+      cfg.xPoints = settings.value("points", cfg.xPoints).toInt();
+      cfg.fly = settings.value("fly", cfg.fly).toBool();
+      cfg.flyTime = settings.value("flyTime", cfg.flyTime).toDouble();
+    }
+  }
+  settings.endArray();
+
+  cfg.scan2D = settings.value("2D", cfg.scan2D).toBool();
+  cfg.snake = settings.value("snake", cfg.snake).toBool();
+  cfg.relaxY = settings.value("relaxY", cfg.relaxY).toDouble();
+  size = settings.beginReadArray("ymotors");
+  for (int i = 0 ; i < size ; i++) {
+    settings.setArrayIndex(i);
+    cfg.yAxes << readAxis(settings);
+    if ( ! i  &&  cfg.scan2D )
+      cfg.yPoints = settings.value("points", cfg.yPoints).toInt();
+  }
+  settings.endArray();
+
+  const double relaxOuter = settings.value("relaxOuter", 0.0).toDouble();
+  size = settings.beginReadArray("outermotors");
+  for (int i = 0 ; i < size ; i++) {
+    settings.setArrayIndex(i);
+    ScanLevel lev(settings.value("points", 2).toInt(), relaxOuter);
+    lev.axes << readAxis(settings);
+    cfg.outer << lev;
+  }
+  settings.endArray();
+
+  cfg.after = settings.value("afterScan", cfg.after).toString();
+  cfg.pipeline = settings.value("pipeline", cfg.pipeline).toBool();
+  cfg.coordinated = settings.value("coordinated", cfg.coordinated).toBool();
+  cfg.persistentScripts = settings.value("persistentScripts", cfg.persistentScripts).toBool();
+  cfg.adaptive = settings.value("adaptive", cfg.adaptive).toBool();
+  cfg.adaptivePoints = settings.value("adaptivePoints", cfg.adaptivePoints).toInt();
+  cfg.adaptiveTolerance = settings.value("adaptiveTolerance", cfg.adaptiveTolerance * 100).toDouble() / 100.0;
+  cfg.adaptiveSignal = settings.value("adaptiveSignal", cfg.adaptiveSignal).toInt();
+  cfg.exposures = settings.value("exposures", cfg.exposures).toInt();
+  cfg.targetError = settings.value("targetError", cfg.targetError * 100).toDouble() / 100.0;
+  const QString dataFormat = settings.value("dataFormat", "Text").toString();
+  cfg.textData = dataFormat != "Binary";
+  cfg.binaryData = dataFormat != "Text";
+  cfg.flushInterval = settings.value("flushInterval", cfg.flushInterval).toDouble();
+  cfg.flushRows = settings.value("flushRows", cfg.flushRows).toInt();
+
+  size = settings.beginReadArray("detectors");
+  for (int i = 0 ; i < size ; i++) {
+    settings.setArrayIndex(i);
+    cfg.signalNames << settings.value("detector").toString();
+  }
+  settings.endArray();
+  if ( cfg.adaptiveSignal < 0  ||  cfg.adaptiveSignal >= cfg.signalNames.size() )
+    cfg.adaptiveSignal = 0;
+
+  if ( settings.value("pointList", false).toBool() ) {
+    cfg.pointListFile = settings.value("pointListFile").toString();
+    if ( ! readList )
+      return QString();
+    if ( ! readPointList(cfg.pointListFile, cfg.pointList) )
+      return "Could not read the point list \"" + cfg.pointListFile + "\".";
+    cfg.xPoints = cfg.pointList.size();
+    cfg.yPoints = 1;
+  }
+
+  return QString();
+
+}
+
+
+/// Reads the header and the data lines of the file written by the interrupted
+/// scan and checks them against _cfg_. The data lines are taken up to the
+/// first one out of order or with the wrong number of columns.
+QString ScanEngine::resumeFile(const QString & fileName, ScanConfig & cfg, QList<ScanPoint> & done) {
+
+  done.clear();
+  if ( cfg.listed()  ||  cfg.isFly()  ||  cfg.isAdaptive() )
+    return "Only step scans on the grid can be resumed.";
+  QFile file(fileName);
+  if ( ! file.open(QIODevice::ReadOnly | QIODevice::Text) )
+    return "Could not open \"" + fileName + "\".";
+
+  QStringList pvs, signalNames;
+  QVector<double> inits;
+  QList< QPair<double,double> > ranges;
+  int points = -1;
+  bool allDone = false;
+  bool averaged = false;
+  QList<QStringList> rows;
+  const QRegExp quoted("\"(.*)\"");
+  const QRegExp separator("\\s+");
+  while ( ! file.atEnd() ) {
+    const QString line = QString(file.readLine()).trimmed();
+    if ( line.isEmpty() )
+      continue;
+    if ( ! line.startsWith('#') ) {
+      rows << line.split(separator, QString::SkipEmptyParts);
+      continue;
+    }
+    const QString comment = line.mid(1).trimmed();
+    const QString value = comment.section(':', 1).trimmed();
+    if ( comment.startsWith("PV: ")  &&  quoted.indexIn(comment) >= 0 )
+      pvs << quoted.cap(1);
+    else if ( comment.startsWith("PV / script: ")  &&  quoted.indexIn(comment) >= 0 )
+      signalNames << quoted.cap(1);
+    else if ( comment.startsWith("Initial position: ") )
+      inits << value.toDouble();
+    else if ( comment.startsWith("Scan range: ") )
+      ranges << qMakePair( value.section("...", 0, 0).toDouble(),
+                           value.section("...", 1).toDouble() );
+    else if ( comment.startsWith("Number of data points: ")  &&  points < 0 )
+      points = value.toInt();
+    else if ( comment.startsWith("All done") )
+      allDone = true;
+    else if ( comment.startsWith("Averaging") )
+      averaged = true;
+    else if ( comment.startsWith("Point list scan")  ||  comment.startsWith("Fly scan")
+              ||  comment.startsWith("Adaptive") )
+      return "The scan in the file can not be resumed.";
+  }
+
+  QList<ScanAxis> axes = cfg.xAxes;
+  if (cfg.scan2D)
+    axes << cfg.yAxes;
+  int nz = 0;
+  foreach (const ScanLevel & level, cfg.outer) {
+    axes << level.axes;
+    nz += level.axes.size();
+  }
+  QStringList axesPvs;
+  foreach (const ScanAxis & ax, axes)
+    axesPvs << ax.pv;
+
+  if (allDone)
+    return "The scan in the file is complete.";
+  if ( pvs != axesPvs )
+    return "The motors in the file differ from the ones of the scan.";
+  if ( inits.size() != axes.size()  ||  ranges.size() != axes.size() )
+    return "The header of the file is incomplete.";
+  if ( signalNames != cfg.signalNames )
+    return "The signals in the file differ from the ones of the scan.";
+  if ( points != cfg.totalPoints() )
+    return "The number of points in the file differs from the one of the scan.";
+  if ( averaged != cfg.averaged() )
+    return "The averaging in the file differs from the one of the scan.";
+  for (int i = 0 ; i < axes.size() ; i++) {
+    const double shift = axes[i].relative  ?  inits[i]  :  0.0;
+    const double start = axes[i].start + shift;
+    const double end = axes[i].end + shift;
+    if ( qAbs(start - ranges[i].first) > 1e-5 * qMax(1.0, qAbs(start))
+         ||  qAbs(end - ranges[i].second) > 1e-5 * qMax(1.0, qAbs(end)) )
+      return "The range of \"" + axes[i].pv + "\" in the file differs from the one of the scan.";
+  }
+
+  const int nx = cfg.xAxes.size();
+  const int ny = cfg.scan2D ? cfg.yAxes.size() : 0;
+  const int ns = cfg.signalNames.size();
+  const int columns = 1 + nx + ny + nz + ns + ( averaged ? ns + 1 : 0 );
+  foreach (const QStringList & row, rows) {
+    if ( row.size() != columns  ||  row[0].toInt() != done.size() + 1 )
+      break;
+    ScanPoint pt;
+    int step;
+    pt.index = done.size();
+    cfg.gridPoint(pt.index, step, pt.ypoint, pt.slice);
+    pt.xpoint = cfg.xpointAt(step, pt.ypoint);
+    int col = 1;
+    for (int i = 0 ; i < nx ; i++)
+      pt.xPos << row[col++].toDouble();
+    for (int i = 0 ; i < ny ; i++)
+      pt.yPos << row[col++].toDouble();
+    for (int i = 0 ; i < nz ; i++)
+      pt.outerPos << row[col++].toDouble();
+    for (int i = 0 ; i < ns ; i++)
+      pt.values << row[col++];
+    if (averaged) {
+      for (int i = 0 ; i < ns ; i++)
+        pt.errors << row[col++].toDouble();
+      pt.count = row[col++].toInt();
+    }
+    done << pt;
+  }
+
+  if ( done.isEmpty() )
+    return "There are no data points in the file.";
+  if ( done.size() >= cfg.totalPoints() )
+    return "All points of the scan are already in the file.";
+
+  cfg.resumeFrom = done.size();
+  cfg.resumeInit = inits;
+  cfg.fileName = fileName;
+  return QString();
+
+}
+
+
+/// Time to move the motor of _pv_ by _dist_: the same model as in moveGroup().
+static double moveTime(const ScanTimings & tm, const QString & pv, double dist) {
+  const double speed = tm.speed.value(pv);
+  if ( dist == 0.0  ||  speed <= 0.0 )
+    return 0.0;
+  return qAbs(dist) / speed + tm.acceleration.value(pv);
+}
+
+
+/// Time to move all _axes_ by the _fraction_ of their ranges.
+static double moveTime(const ScanTimings & tm, const QList<ScanAxis> & axes, double fraction) {
+  double longest = 0.0;
+  foreach (const ScanAxis & ax, axes)
+    longest = qMax(longest, moveTime(tm, ax.pv, fraction * (ax.end - ax.start)));
+  return longest;
+}
+
+
+/// The readings of the point are added up for all exposures and the motion
+/// to the next point overlaps them in the pipelined scan. Point list scans are
+/// estimated in the order of the list: the ordering only makes them shorter.
+double ScanEngine::estimate(const ScanConfig & cfg, const ScanTimings & tm) {
+
+  double reading = 0.0; // signals are read in parallel
+  foreach (const QString & name, cfg.signalNames)
+    reading = qMax(reading, tm.signalTime.value(name));
+  if ( cfg.averaged() )
+    reading *= cfg.exposures;
+
+  QList<ScanAxis> lineAxes = cfg.xAxes;
+  if ( cfg.listed()  &&  cfg.scan2D ) // Y positions follow X in the list
+    lineAxes << cfg.yAxes;
+
+  double line = 0.0;
+  double lineReturn = moveTime(tm, cfg.xAxes, 1.0);
+  if ( cfg.listed() ) {
+    line = reading;
+    lineReturn = 0.0;
+    for (int i = 0 ; i < lineAxes.size() ; i++)
+      lineReturn = qMax(lineReturn, moveTime(tm, lineAxes[i].pv,
+                                             cfg.pointList.first().value(i) - cfg.pointList.last().value(i)));
+    for (int pnt = 1 ; pnt < cfg.pointList.size() ; pnt++) {
+      double step = 0.0;
+      for (int i = 0 ; i < lineAxes.size() ; i++)
+        step = qMax(step, moveTime(tm, lineAxes[i].pv,
+                                   cfg.pointList[pnt].value(i) - cfg.pointList[pnt-1].value(i)));
+      line += cfg.pipeline  ?  qMax(step, reading)  :  step + reading;
+    }
+  } else if ( cfg.isFly() ) {
+    double accel = 0.0;
+    foreach (const ScanAxis & ax, cfg.xAxes)
+      accel = qMax(accel, tm.acceleration.value(ax.pv));
+    line = cfg.xPoints * cfg.flyTime + 2 * accel; // run-up and slow-down
+  } else {
+    const int points = cfg.isAdaptive() ? cfg.totalPoints() : cfg.xPoints;
+    const double step = cfg.xPoints > 1  ?  moveTime(tm, cfg.xAxes, 1.0 / (cfg.xPoints - 1))  :  0.0;
+    line = reading + qMax(0, points - 1) * ( cfg.pipeline  ?  qMax(step, reading)  :  step + reading );
+  }
+
+  double slice = line;
+  if ( cfg.grid2D() ) {
+    const double yStep = cfg.yPoints > 1  ?  moveTime(tm, cfg.yAxes, 1.0 / (cfg.yPoints - 1))  :  0.0;
+    const double next = yStep + cfg.relaxY + ( cfg.snake ? 0.0 : lineReturn );
+    slice = cfg.yPoints * line + ( cfg.yPoints - 1 ) * next;
+  }
+
+  double total = slice;
+  if ( ! cfg.outer.isEmpty() ) {
+    const ScanLevel & inner = cfg.outer.first();
+    const double outerStep = inner.points > 1  ?  moveTime(tm, inner.axes, 1.0 / (inner.points - 1))  :  0.0;
+    double sliceReturn = lineReturn;
+    if ( cfg.grid2D() )
+      sliceReturn = qMax(sliceReturn, moveTime(tm, cfg.yAxes, 1.0));
+    total = cfg.slices() * slice
+        + ( cfg.slices() - 1 ) * ( qMax(outerStep, sliceReturn) + inner.relax );
+  }
+  return total;
+
+}
+
+
+QCaMotor * ScanEngine::motor(const QString & pv) {
+  if ( ! motors.contains(pv) ) {
+    QCaMotor * mot = new QCaMotor;
+    mot->setPv(pv);
+    connect(mot, SIGNAL(changedMoving(bool)), SLOT(onMotorMoving(bool)));
+    connect(mot, SIGNAL(changedConnected(bool)), SLOT(advance()));
+    motors[pv] = mot;
+  }
+  return motors[pv];
+}
+
+
+ScanEngine::Detector * ScanEngine::detector(const QString & name) {
+  if ( ! detectors.contains(name) ) {
+    Detector * det = new Detector(name, this);
+    connect(det->pv, SIGNAL(connectionChanged(bool)), SLOT(advance()));
+    connect(det, SIGNAL(done()), SLOT(advance()));
+    detectors[name] = det;
+  }
+  return detectors[name];
+}
+
+
+/// All motors are connected and the fresh PVs had their chance to.
+/// PVs which did not connect are treated as scripts:
+/// no need to wait for them again in the following scans.
+bool ScanEngine::connected() const {
+  foreach (QCaMotor * mot, scanMotors())
+    if ( ! mot->isConnected() )
+      return false;
+  foreach (Detector * det, dets)
+    if ( det->fresh  &&  ! det->pv->isConnected() )
+      return false;
+  return true;
+}
+
+
+/// Sends the motor and tracks its motion. The motor has arrived when it
+/// reports the end of the motion or did not start moving in motionStartTimeout.
+/// A motor already within half of its last displayed digit from _pos_ is
+/// not sent at all: it has arrived without waiting for the timeout.
+void ScanEngine::go(QCaMotor * mot, double pos) {
+  const double tolerance = 0.5 * pow(10.0, - mot->getPrecision());
+  if ( ! mot->isMoving()  &&  qAbs(mot->getUserPosition() - pos) <= tolerance ) {
+    motion[mot] = ARRIVED;
+    QMetaObject::invokeMethod(this, "advance", Qt::QueuedConnection);
+    return;
+  }
+  motion[mot] = COMMANDED;
+  mot->goUserPosition(pos, QCaMotor::IMMIDIATELY);
+  motionTimer.start();
+}
+
+
+/// Sends the motors to their positions all at once.
+///
+/// With ScanConfig::coordinated the speeds are scaled down so that all
+/// motors of the group arrive together with the slowest one: each motor
+/// takes about distance/speed plus its acceleration time. The speeds prior
+/// to the scan are remembered and restored by restoreSpeeds().
+void ScanEngine::moveGroup(const QList<QCaMotor*> & mots, const QVector<double> & pos) {
+
+  if ( cfg.coordinated  &&  mots.size() > 1 ) {
+
+    QVector<double> dist(mots.size()), speed(mots.size());
+    double longest = 0;
+    for (int i = 0 ; i < mots.size() ; i++) {
+      QCaMotor * mot = mots[i];
+      if ( ! normalSpeed.contains(mot) )
+        normalSpeed[mot] = mot->getNormalSpeed();
+      speed[i] = normalSpeed[mot];
+      dist[i] = qAbs( pos[i] - mot->getUserPosition() );
+      if ( speed[i] > 0.0 )
+        longest = qMax(longest, dist[i] / speed[i] + mot->getAcceleration());
+    }
+
+    for (int i = 0 ; i < mots.size() ; i++) {
+      const double travel = longest - mots[i]->getAcceleration();
+      if ( dist[i] > 0.0  &&  travel > 0.0 )
+        speed[i] = qMin(speed[i], dist[i] / travel);
+      if ( speed[i] > 0.0  &&  speed[i] != mots[i]->getNormalSpeed() )
+        mots[i]->setNormalSpeed(speed[i]);
+    }
+
+  }
+
+  for (int i = 0 ; i < mots.size() ; i++)
+    go(mots[i], pos[i]);
+
+}
+
+
+/// The point variable (XPOINT etc) goes into the environment of the signal
+/// scripts; the environment of the application is not touched.
+void ScanEngine::setPointVariable(const QString & name, int value) {
+  foreach (Detector * det, dets)
+    det->scr->setVariable(name, QString::number(value));
+}
+
+
+void ScanEngine::restoreSpeeds() {
+  QHash<QCaMotor*, double>::const_iterator it;
+  for ( it = normalSpeed.constBegin() ; it != normalSpeed.constEnd() ; ++it )
+    it.key()->setNormalSpeed(it.value());
+  normalSpeed.clear();
+}
+
+
+/// All motors of the scan: X, Y and those of the outer levels.
+QList<QCaMotor*> ScanEngine::scanMotors() const {
+  return xMotors + yMotors + outerMotors;
+}
+
+
+bool ScanEngine::arrived(const QList<QCaMotor*> & mots) const {
+  foreach (QCaMotor * mot, mots)
+    if ( motion.value(mot, ARRIVED) != ARRIVED )
+      return false;
+  return true;
+}
+
+
+void ScanEngine::onMotorMoving(bool moving) {
+  QCaMotor * mot = qobject_cast<QCaMotor*>(sender());
+  if ( ! mot  ||  ! motion.contains(mot) )
+    return;
+  if (moving)
+    motion[mot] = MOVING;
+  else if ( motion[mot] == MOVING )
+    motion[mot] = ARRIVED;
+  advance();
+}
+
+
+void ScanEngine::onMotionStartTimeout() {
+  QHash<QCaMotor*, Motion>::iterator it;
+  for ( it = motion.begin() ; it != motion.end() ; ++it )
+    if ( it.value() == COMMANDED ) {
+      if ( it.key()->isMoving() )
+        it.value() = MOVING;
+      else
+        it.value() = ARRIVED;
+    }
+  advance();
+}
+
+
+void ScanEngine::readPositions(const QList<QCaMotor*> & mots, QVector<double> & pos, const QString & axis) {
+  pos.resize(mots.size());
+  for (int i = 0 ; i < mots.size() ; i++) {
+    if ( mots[i]->getLoLimitStatus() || mots[i]->getHiLimitStatus() )
+      dataStr <<  "# " + axis + " Axis: " + mots[i]->getPv() + " limit hit.\n";
+    pos[i] = mots[i]->getUserPosition();
+  }
+}
+
+
+void ScanEngine::stop() {
+  stopNow.store(1);
+  QMetaObject::invokeMethod(this, "onStop", Qt::QueuedConnection);
+}
+
+
+/// Interrupts whatever is going on: timers, acquisition and motion.
+/// The scan is finished as soon as the motors halt.
+void ScanEngine::onStop() {
+
+  if ( ! isScanning() )
+    return;
+
+  const QList<QCaMotor*> allMotors = scanMotors();
+  switch (state) {
+  case IDLE:
+    return;
+  case CONNECTING:
+    abort();
+    return;
+  case FINISHING: // interrupts after-scan positioning
+    foreach (QCaMotor * mot, allMotors)
+      mot->stop();
+    return;
+  case STOPPING:
+    return;
+  default:
+    break;
+  }
+
+  timer.stop();
+  foreach (Detector * det, dets)
+    det->cancel();
+  foreach (QCaMotor * mot, allMotors)
+    mot->stop();
+  restoreFlySpeeds();
+
+  state = STOPPING;
+  foreach (QCaMotor * mot, allMotors)
+    motion[mot] = mot->isMoving() ? MOVING : ARRIVED;
+  advance();
+
+}
+
+
+/// The scan is held at the next point boundary (the end of the line in the
+/// fly scan), once the point is in the data file.
+void ScanEngine::pause() {
+  if ( isScanning() )
+    pausing = true;
+}
+
+
+void ScanEngine::resume() {
+  pausing = false;
+  if ( state != PAUSED )
+    return;
+  emit paused(false);
+  (this->*proceed)();
+}
+
+
+/// Goes on with _next_ unless the pause was requested.
+void ScanEngine::hold(Continuation next) {
+  if ( ! pausing ) {
+    (this->*next)();
+    return;
+  }
+  proceed = next;
+  state = PAUSED;
+  emit paused(true);
+}
+
+
+static void prepareAxis(const ScanAxis & ax, double initPos, QPair<double,double> & range) {
+  double start = ax.start;
+  double end = ax.end;
+  if (ax.relative) {
+    start += initPos;
+    end += initPos;
+  }
+  range = qMakePair(start, end);
+}
+
+
+static void describeAndPrepareAxis(const ScanAxis & ax, QCaMotor * mot, QTextStream & dataStr,
+                                   double & initPos, QPair<double,double> & range, bool withRange) {
+
+  dataStr << "# PV: \"" << mot->getPv() << "\"\n"
+          << "# Description: \"" << mot->getDescription() << "\"\n";
+
+  // full precision: the scan may be resumed from the header (see ScanEngine::resumeFile)
+  initPos = mot->getUserPosition();
+  dataStr << "# Initial position: " << QString::number(initPos, 'g', 15) << "\n";
+
+  prepareAxis(ax, initPos, range);
+  if (withRange)
+    dataStr << "# Scan range: " << QString::number(range.first, 'g', 15)
+            << " ... " << QString::number(range.second, 'g', 15) << "\n";
+  dataStr << "#\n";
+
+}
+
+
+static inline double positionAt(const QPair<double,double> & range, int point, int points) {
+  if ( points < 2 )
+    return range.first;
+  return range.first + ( point * ( range.second - range.first ) ) / (points - 1);
+}
+
+
+/// Environment variable with the point of the outer level: ZPOINT, Z1POINT, Z2POINT...
+static inline QString outerPointName(int level) {
+  return "Z" + ( level ? QString::number(level) : QString() ) + "POINT";
+}
+
+
+
+
+void ScanEngine::start(const ScanConfig & _cfg) {
+
+  if ( isScanning() )
+    return;
+  cfg = _cfg;
+  scanning.store(1);
+  // stopNow is not reset here: the stop may be requested before the scan has
+  // actually started in this thread. It is reset when the scan is finished.
+  if ( stopNow.load() ) {
+    abort();
+    return;
+  }
+
+  prepare();
+
+}
+
+
+/// Collects the motors and signals of the scan and waits for them to connect.
+void ScanEngine::prepare() {
+
+  xMotors.clear();
+  yMotors.clear();
+  outerMotors.clear();
+  outerLevel.clear();
+  dets.clear();
+  motion.clear();
+  normalSpeed.clear();
+  profile.clear();
+  flyNormalSpeed.clear();
+  curpoint = cfg.resumeFrom;
+  ypoint = 0;
+  step = 0;
+  prefetched = false;
+  pausing = false;
+  refining = false;
+  sampling = false;
+  listPos.clear();
+  order.clear();
+  cur = ScanPoint();
+
+  foreach (const ScanAxis & ax, cfg.xAxes)
+    xMotors << motor(ax.pv);
+  if (cfg.scan2D) // listed points too: Y positions follow X in the list
+    foreach (const ScanAxis & ax, cfg.yAxes)
+      yMotors << motor(ax.pv);
+  foreach (const QString & name, cfg.signalNames)
+    dets << detector(name);
+  foreach (Detector * det, dets)
+    det->scr->clearVariables();
+  for (int lev = 0 ; lev < cfg.outer.size() ; lev++)
+    foreach (const ScanAxis & ax, cfg.outer[lev].axes) {
+      outerMotors << motor(ax.pv);
+      outerLevel << lev;
+    }
+  outerPoint.fill(0, cfg.outer.size());
+  cfg.gridPoint(cfg.resumeFrom, resumeStep, resumeY, slice);
+  int inner = 1; // slices per point of the level
+  for (int lev = 0 ; lev < outerPoint.size() ; lev++) {
+    outerPoint[lev] = ( slice / inner ) % cfg.outer[lev].points;
+    inner *= cfg.outer[lev].points;
+  }
+
+  state = CONNECTING;
+  if ( connected() ) {
+    begin();
+  } else {
+    timer.setSingleShot(true);
+    timer.start(connectionTimeout);
+  }
+
+}
+
+
+/// Scan aborted before it has begun: nothing was written nor moved.
+void ScanEngine::abort() {
+  timer.stop();
+  foreach (Detector * det, dets)
+    det->scr->stopPersistent();
+  state = IDLE;
+  stopNow.store(0);
+  scanning.store(0);
+  emit finished(true);
+}
+
+
+void ScanEngine::begin() {
+
+  timer.stop();
+  foreach (Detector * det, dets)
+    det->fresh = false;
+  foreach (QCaMotor * mot, scanMotors())
+    if ( ! mot->isConnected() ) {
+      warn("Motor \"" + mot->getPv() + "\" is not connected. Scan aborted.", this);
+      abort();
+      return;
+    }
+
+  const int nmot = xMotors.size() + yMotors.size();
+  for (int pnt = 0 ; pnt < cfg.pointList.size() ; pnt++)
+    if ( cfg.pointList[pnt].size() < nmot ) {
+      warn("Point " + QString::number(pnt+1) + " of the list has less than "
+           + QString::number(nmot) + " positions. Scan aborted.", this);
+      abort();
+      return;
+    }
+
+  if ( cfg.isFly() ) {
+    bool flat = cfg.xPoints < 2;
+    foreach (const ScanAxis & ax, cfg.xAxes)
+      flat |= ax.start == ax.end;
+    if (flat) {
+      warn("Fly scan needs at least two X points and a non-zero X range. Scan aborted.", this);
+      abort();
+      return;
+    }
+  }
+
+  if ( cfg.resumeFrom > 0  &&  ( cfg.listed() || cfg.isFly() || cfg.isAdaptive() ) ) {
+    warn("Only step scans on the grid can be resumed. Scan aborted.", this);
+    abort();
+    return;
+  }
+
+  // only once nothing can abort the scan before it runs
+  if (cfg.persistentScripts)
+    foreach (Detector * det, dets)
+      if ( ! det->pv->isConnected()  &&  ! det->scr->startPersistent() )
+        warn("Could not start persistent script \"" + det->scr->path() + "\".", this);
+
+  if ( cfg.resumeFrom > 0 )
+    resumeHeader();
+  else
+    writeHeader();
+  if ( cfg.listed() )
+    orderPoints();
+  emit started(cfg.totalPoints());
+  beginSlice(outerPoint.size());
+
+}
+
+
+void ScanEngine::writeHeader() {
+
+  // Data file
+  if ( ! cfg.fileName.isEmpty()  &&  cfg.textData )
+    QMetaObject::invokeMethod(dataWriter, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, cfg.fileName), Q_ARG(bool, false),
+                              Q_ARG(double, cfg.flushInterval), Q_ARG(int, cfg.flushRows));
+
+  flyRaw = cfg.isFly() && ! cfg.fileName.isEmpty();
+  if (flyRaw) {
+    QMetaObject::invokeMethod(flyWriter, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, cfg.fileName + ".fly"), Q_ARG(bool, false),
+                              Q_ARG(double, cfg.flushInterval), Q_ARG(int, cfg.flushRows));
+    flyStr
+        << "# ScanMX raw samples of the fly scan \"" << cfg.fileName << "\"\n"
+        << "# Data columns:\n"
+        << "# %Line %Time(s) ";
+    foreach (const ScanAxis & ax, cfg.xAxes)
+      flyStr << "%" << ax.pv << " ";
+    foreach (const QString & name, cfg.signalNames)
+      flyStr << "%" << name << " ";
+    flyStr << "\n";
+    pass(flyWriter, flyStr, flyBuf, 0);
+  }
+
+  dataStr
+      << "# ScanMX\n"
+      << "#\n"
+      << "# Date: " << QDate::currentDate().toString() << "\n"
+      << "# Time: " << QTime::currentTime().toString() << "\n"
+      << "#\n";
+
+  //sizes
+  const int xPoints = cfg.xPoints;
+  const int yPoints = cfg.grid2D() ? cfg.yPoints : 1;
+  const int totalPoints = xPoints * yPoints;
+
+  if ( cfg.listed() )
+    dataStr
+        << "# Point list scan: \"" << cfg.pointListFile << "\"\n"
+        << "# Number of data points: " << cfg.pointList.size() * cfg.slices() << "\n"
+        << "# Points are ordered for the shortest travel; %Index is the line in the list\n";
+  else
+    dataStr
+        << "# " << (cfg.scan2D ? "2" : "1") << "D scan\n"
+        << "# Number of data points: " << totalPoints * cfg.slices() << "\n";
+  if ( cfg.grid2D() )
+    dataStr
+        << "# Number of X axis points: " << xPoints << "\n"
+        << "# Number of Y axis points: " << yPoints << "\n"
+        << "#\n";
+  if ( ! cfg.outer.isEmpty() ) {
+    dataStr << "# Number of outer levels: " << cfg.outer.size() << "\n";
+    for (int lev = 0 ; lev < cfg.outer.size() ; lev++)
+      dataStr << "# Number of Z" << lev << " axis points: " << cfg.outer[lev].points << "\n";
+    dataStr << "# Number of slices: " << cfg.slices() << "\n"
+            << "#\n";
+  }
+  if ( cfg.isFly() )
+    dataStr
+        << "# Fly scan, " << cfg.flyTime << "s per point\n";
+  if ( cfg.grid2D() && cfg.snake )
+    dataStr
+        << "# Snake raster: X direction is reversed in odd lines\n";
+  if ( cfg.averaged() ) {
+    dataStr
+        << "# Averaging: up to " << cfg.exposures << " exposures per point";
+    if ( cfg.targetError > 0.0 )
+      dataStr << ", until the relative error of the mean is below " << cfg.targetError;
+    dataStr << "\n";
+  }
+  if ( cfg.isAdaptive() )
+    dataStr
+        << "# Adaptive refinement: up to " << cfg.totalPoints() << " points,"
+        << " tolerance " << cfg.adaptiveTolerance
+        << " on \"" << cfg.signalNames[cfg.adaptiveSignal] << "\"\n";
+  dataStr << "#\n";
+
+  xInit.resize(xMotors.size());
+  yInit.resize(yMotors.size());
+  xRange.resize(xMotors.size());
+  yRange.resize(yMotors.size());
+
+  dataStr << "# Number of X motors:" << xMotors.size() << "\n";
+  for (int i = 0 ; i < xMotors.size() ; i++) {
+    if (xMotors.size() > 1)
+      dataStr << "# X axis, motor " << i << "\n";
+    else
+      dataStr << "# X axis\n";
+    describeAndPrepareAxis(cfg.xAxes[i], xMotors[i], dataStr, xInit[i], xRange[i], ! cfg.listed());
+  }
+
+  for (int i = 0 ; i < yMotors.size() ; i++) {
+    if (yMotors.size() > 1)
+      dataStr << "# Y axis, motor " << i << "\n";
+    else
+      dataStr << "# Y axis\n";
+    describeAndPrepareAxis(cfg.yAxes[i], yMotors[i], dataStr, yInit[i], yRange[i], ! cfg.listed());
+  }
+
+  outerInit.resize(outerMotors.size());
+  outerRange.resize(outerMotors.size());
+  for (int i = 0 ; i < outerMotors.size() ; i++) {
+    const int lev = outerLevel[i];
+    const int idx = outerLevel.indexOf(lev);
+    dataStr << "# Z" << lev << " axis, motor " << i - idx << "\n";
+    describeAndPrepareAxis(cfg.outer[lev].axes[i - idx], outerMotors[i], dataStr,
+                           outerInit[i], outerRange[i], true);
+  }
+
+  dataStr << "#\n"
+          << "#\n"
+          << "# Signals:\n"
+          << "#\n";
+  foreach (const QString & name, cfg.signalNames)
+    dataStr
+        << "# PV / script: \"" << name << "\"\n";
+  dataStr << "#\n";
+
+  dataStr
+      << "# Data columns:\n"
+      << "# "
+      << "%Point "
+      << ( cfg.listed() ? "%Index " : "" )
+      << "%X "
+      << ( yMotors.size() ? "%Y " : "" );
+  for (int lev = 0 ; lev < cfg.outer.size() ; lev++)
+    dataStr << "%Z" << lev << " ";
+  foreach (const QString & name, cfg.signalNames)
+    dataStr
+        << "%" << name << " ";
+  if ( cfg.averaged() ) {
+    foreach (const QString & name, cfg.signalNames)
+      dataStr
+          << "%std(" << name << ") ";
+    dataStr << "%Count ";
+  }
+  dataStr << "\n";
+  dataStr.flush();
+
+  binOut = cfg.binaryData && ! cfg.fileName.isEmpty();
+  if (binOut) {
+    QMetaObject::invokeMethod(binWriter, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, cfg.fileName + ".bin"), Q_ARG(bool, false),
+                              Q_ARG(double, cfg.flushInterval), Q_ARG(int, cfg.flushRows));
+    QMetaObject::invokeMethod(binWriter, "writeRaw", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, BinaryScan::header(dataBuf, binaryColumns())),
+                              Q_ARG(int, 0));
+  }
+  pass(dataWriter, dataStr, dataBuf, 0);
+
+}
+
+
+/// Names of the columns in the binary data file: one per motor.
+QStringList ScanEngine::binaryColumns() const {
+  QStringList columns;
+  columns << "Point";
+  if ( cfg.listed() )
+    columns << "Index";
+  for (int i = 0 ; i < xMotors.size() ; i++)
+    columns << ( xMotors.size() > 1  ?  "X" + QString::number(i)  :  QString("X") );
+  for (int i = 0 ; i < yMotors.size() ; i++)
+    columns << ( yMotors.size() > 1  ?  "Y" + QString::number(i)  :  QString("Y") );
+  for (int i = 0 ; i < outerMotors.size() ; i++) {
+    const int lev = outerLevel[i];
+    columns << "Z" + QString::number(lev);
+    if ( outerLevel.count(lev) > 1 )
+      columns.last() += "." + QString::number(i - outerLevel.indexOf(lev));
+  }
+  columns << cfg.signalNames;
+  if ( cfg.averaged() ) {
+    foreach (const QString & name, cfg.signalNames)
+      columns << "std(" + name + ")";
+    columns << "Count";
+  }
+  return columns;
+}
+
+
+/// Appends to the data file of the resumed scan. The initial positions
+/// are the ones of the interrupted scan so that the relative ranges and the
+/// after-scan positioning stay the same.
+void ScanEngine::resumeHeader() {
+
+  flyRaw = false;
+  if ( ! cfg.fileName.isEmpty()  &&  cfg.textData )
+    QMetaObject::invokeMethod(dataWriter, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, cfg.fileName), Q_ARG(bool, true),
+                              Q_ARG(double, cfg.flushInterval), Q_ARG(int, cfg.flushRows));
+
+  dataStr
+      << "#\n"
+      << "# Resumed at point " << cfg.resumeFrom + 1 << ": "
+      << QDate::currentDate().toString() << " " << QTime::currentTime().toString() << "\n"
+      << "#\n";
+  pass(dataWriter, dataStr, dataBuf, 0);
+
+  // The binary file loses the rows past the resumed point, if any.
+  binOut = false;
+  if ( cfg.binaryData  &&  ! cfg.fileName.isEmpty() ) {
+    const QString binName = cfg.fileName + ".bin";
+    BinaryScan bin(binName);
+    if ( ! bin.open() ) {
+      warn("Binary data file \"" + binName + "\" is not appended: " + bin.errorString(), this);
+    } else if ( bin.rows() < cfg.resumeFrom ) {
+      warn("Binary data file \"" + binName + "\" is not appended: it has "
+           + QString::number(bin.rows()) + " of the " + QString::number(cfg.resumeFrom)
+           + " points done.", this);
+    } else {
+      const qint64 keep = bin.dataOffset() + cfg.resumeFrom * bin.rowBytes();
+      bin.close();
+      binOut = QFile::resize(binName, keep);
+      if (binOut)
+        QMetaObject::invokeMethod(binWriter, "open", Qt::QueuedConnection,
+                                  Q_ARG(QString, binName), Q_ARG(bool, true),
+                                  Q_ARG(double, cfg.flushInterval), Q_ARG(int, cfg.flushRows));
+    }
+  }
+
+  xInit.resize(xMotors.size());
+  yInit.resize(yMotors.size());
+  outerInit.resize(outerMotors.size());
+  xRange.resize(xMotors.size());
+  yRange.resize(yMotors.size());
+  outerRange.resize(outerMotors.size());
+
+  int idx = 0;
+  for (int i = 0 ; i < xMotors.size() ; i++, idx++) {
+    xInit[i] = idx < cfg.resumeInit.size()  ?  cfg.resumeInit[idx]  :  xMotors[i]->getUserPosition();
+    prepareAxis(cfg.xAxes[i], xInit[i], xRange[i]);
+  }
+  for (int i = 0 ; i < yMotors.size() ; i++, idx++) {
+    yInit[i] = idx < cfg.resumeInit.size()  ?  cfg.resumeInit[idx]  :  yMotors[i]->getUserPosition();
+    prepareAxis(cfg.yAxes[i], yInit[i], yRange[i]);
+  }
+  for (int i = 0 ; i < outerMotors.size() ; i++, idx++) {
+    const int lev = outerLevel[i];
+    outerInit[i] = idx < cfg.resumeInit.size()  ?  cfg.resumeInit[idx]  :  outerMotors[i]->getUserPosition();
+    prepareAxis(cfg.outer[lev].axes[i - outerLevel.indexOf(lev)], outerInit[i], outerRange[i]);
+  }
+
+}
+
+
+/// Checks whether the current state is complete and moves on.
+/// Called on any event which may complete it: motor done, signal done,
+/// connection change.
+void ScanEngine::advance() {
+
+  switch (state) {
+
+  case CONNECTING:
+    if ( connected() )
+      begin();
+    break;
+
+  case MOVING_OUTER:
+    if ( ! arrived(outerMotors) )
+      break;
+    readPositions(outerMotors, cur.outerPos, "Outer");
+    if ( outerRelax > 0.0 ) {
+      state = SETTLING_OUTER;
+      timer.setSingleShot(true);
+      timer.start( outerRelax * 1000 );
+    } else {
+      beginRow();
+    }
+    break;
+
+  case MOVING_Y:
+    if ( ! arrived(yMotors) )
+      break;
+    readPositions(yMotors, cur.yPos, "Y");
+    if ( cfg.relaxY > 0.0 ) {
+      state = SETTLING_Y;
+      timer.setSingleShot(true);
+      timer.start( cfg.relaxY * 1000 );
+    } else {
+      beginLine();
+    }
+    break;
+
+  case MOVING_X:
+    if ( ! arrived(xMotors + yMotors) ) // Y moves too in the point list scan
+      break;
+    readPositions(xMotors, cur.xPos, "X");
+    if ( cfg.listed() )
+      readPositions(yMotors, cur.yPos, "Y");
+    state = ACQUIRING;
+    exposure = 0;
+    expCount.fill(0, dets.size());
+    expSum.fill(0.0, dets.size());
+    expSumSq.fill(0.0, dets.size());
+    trigger(false, pointRequest(cur.xpoint, cur.ypoint));
+    if ( acquired() )
+      exposureDone();
+    break;
+
+  case ACQUIRING:
+    if ( acquired() )
+      exposureDone();
+    break;
+
+  case FLY_RUNUP:
+    if ( arrived(xMotors) )
+      flyStart();
+    break;
+
+  case FLYING:
+    if ( sampling  &&  acquired() )
+      storeSample();
+    if ( ! sampling  &&  arrived(xMotors) )
+      flyEnd();
+    break;
+
+  case STOPPING:
+    if ( arrived(scanMotors()) )
+      finish();
+    break;
+
+  case FINISHING:
+    if ( arrived(scanMotors()) )
+      complete();
+    break;
+
+  default:
+    break;
+
+  }
+
+}
+
+
+void ScanEngine::onTimer() {
+  switch (state) {
+  case CONNECTING: // timeout
+    begin();
+    break;
+  case SETTLING_OUTER:
+    beginRow();
+    break;
+  case SETTLING_Y:
+    beginLine();
+    break;
+  case FLYING: // sampling period; busy signals skip the tick
+    if ( ! sampling )
+      startSample();
+    break;
+  default:
+    break;
+  }
+}
+
+
+void ScanEngine::beginRow() {
+  step = resumeStep;
+  resumeStep = 0;
+  prefetched = false; // the first step, also the resumed one, is always moved to
+  refining = false;
+  cur.ypoint = ypoint;
+  if ( ! cfg.grid2D() ) {
+    beginLine();
+    return;
+  }
+  setPointVariable("YPOINT", ypoint);
+  state = MOVING_Y;
+  QVector<double> pos(yMotors.size());
+  for (int i = 0 ; i < yMotors.size() ; i++)
+    pos[i] = positionAt(yRange[i], ypoint, cfg.yPoints);
+  moveGroup(yMotors, pos);
+}
+
+
+void ScanEngine::beginLine() {
+  if ( cfg.isFly() )
+    flyRunup();
+  else
+    moveToStep();
+}
+
+
+/// Step scan of the X line.
+///
+/// In the pipelined mode the motors are sent to the next point as soon as
+/// the signals are read in the current one and the point is recorded while
+/// they move.
+void ScanEngine::moveToStep() {
+  const int xpoint = cfg.listed()  ?  order[step]
+                   : cfg.reversed(ypoint)  ?  cfg.xPoints - 1 - step  :  step;
+  setPointVariable("XPOINT", xpoint);
+  cur.xpoint = xpoint;
+  state = MOVING_X;
+  if ( ! prefetched ) // otherwise already on the way
+    moveToPoint(xpoint);
+  prefetched = false;
+  // the motors may have arrived while the previous point was recorded
+  QMetaObject::invokeMethod(this, "advance", Qt::QueuedConnection);
+}
+
+
+int ScanEngine::lineSize() const {
+  return cfg.listed()  ?  cfg.pointList.size()  :  cfg.xPoints;
+}
+
+
+/// Sends the X motors (and the Y motors in the point list scan) to the point of the line.
+void ScanEngine::moveToPoint(int xpoint) {
+  if ( cfg.listed() ) {
+    moveGroup(xMotors + yMotors, listPos[xpoint]);
+  } else {
+    QVector<double> pos(xMotors.size());
+    for (int i = 0 ; i < xMotors.size() ; i++)
+      pos[i] = positionAt(xRange[i], xpoint, cfg.xPoints);
+    moveGroup(xMotors, pos);
+  }
+}
+
+
+/// Travel time between two points: the motors move simultaneously.
+static double travel(const QVector<double> & from, const QVector<double> & to,
+                     const QVector<double> & speed) {
+  double tm = 0;
+  for (int i = 0 ; i < speed.size() ; i++)
+    tm = qMax(tm, qAbs(to[i] - from[i]) / speed[i]);
+  return tm;
+}
+
+
+/// Orders the listed points for the shortest travel from the current position:
+/// the nearest neighbour path is improved by 2-opt (reversal of the path
+/// segments) until no reversal helps or the time budget is spent.
+/// The distance is the travel time of the slowest motor.
+void ScanEngine::orderPoints() {
+
+  const QList<QCaMotor*> allMotors = xMotors + yMotors;
+  const QVector<double> allInit = xInit + yInit;
+  const QList<ScanAxis> allAxes = cfg.xAxes + cfg.yAxes;
+  const int nmot = allMotors.size();
+  const int npts = cfg.pointList.size();
+
+  QVector<double> speed(nmot);
+  for (int i = 0 ; i < nmot ; i++) {
+    speed[i] = allMotors[i]->getNormalSpeed();
+    if ( speed[i] <= 0.0 )
+      speed[i] = 1.0;
+  }
+
+  listPos.resize(npts);
+  for (int pnt = 0 ; pnt < npts ; pnt++) {
+    listPos[pnt] = cfg.pointList[pnt].mid(0, nmot);
+    for (int i = 0 ; i < nmot ; i++)
+      if ( allAxes[i].relative )
+        listPos[pnt][i] += allInit[i];
+  }
+
+  // nearest neighbour
+  order.resize(npts);
+  QVector<bool> taken(npts, false);
+  QVector<double> here = allInit;
+  for (int stp = 0 ; stp < npts ; stp++) {
+    int best = -1;
+    double bestTime = 0;
+    for (int pnt = 0 ; pnt < npts ; pnt++) {
+      if ( taken[pnt] )
+        continue;
+      const double tm = travel(here, listPos[pnt], speed);
+      if ( best < 0  ||  tm < bestTime ) {
+        best = pnt;
+        bestTime = tm;
+      }
+    }
+    taken[best] = true;
+    order[stp] = best;
+    here = listPos[best];
+  }
+
+  // 2-opt on the open path starting at the initial position
+  QElapsedTimer clock;
+  clock.start();
+  bool improved = true;
+  while ( improved  &&  clock.elapsed() < orderingTime ) {
+    improved = false;
+    for (int i = -1 ; i < npts - 2 ; i++) {
+      const QVector<double> & a = i < 0  ?  allInit  :  listPos[order[i]];
+      const QVector<double> & b = listPos[order[i+1]];
+      const double ab = travel(a, b, speed);
+      for (int j = i + 2 ; j < npts ; j++) {
+        const QVector<double> & c = listPos[order[j]];
+        double delta = travel(a, c, speed) - ab;
+        if ( j < npts - 1 ) {
+          const QVector<double> & d = listPos[order[j+1]];
+          delta += travel(b, d, speed) - travel(c, d, speed);
+        }
+        if ( delta < -1e-12 ) {
+          std::reverse(order.begin() + i + 1, order.begin() + j + 1);
+          improved = true;
+          break;
+        }
+      }
+    }
+  }
+
+}
+
+
+/// Starts the acquisition in all signals at once:
+/// the point is done when the slowest one returns.
+void ScanEngine::trigger(bool latest, const QString & request) {
+  foreach (Detector * det, dets)
+    det->trigger(latest, request);
+}
+
+
+bool ScanEngine::acquired() const {
+  foreach (Detector * det, dets)
+    if ( ! det->isDone() )
+      return false;
+  return true;
+}
+
+
+/// The values are in the order of the signals.
+QStringList ScanEngine::collect() const {
+  QStringList vals;
+  foreach (Detector * det, dets)
+    vals << det->value().toString();
+  return vals;
+}
+
+
+static inline double signalValue(const ScanPoint & pt, int sig) {
+  bool ok;
+  const double val = pt.values.value(sig).toDouble(&ok);
+  return ok ? val : NAN;
+}
+
+
+/// Accumulates the reading of the signals and repeats it in the averaged scan.
+void ScanEngine::exposureDone() {
+
+  exposure++;
+  cur.values = collect();
+  for (int i = 0 ; i < dets.size() ; i++)
+    if ( dets[i]->readTime() >= 0.0 )
+      emit signalTimed(cfg.signalNames[i], dets[i]->readTime());
+  if ( ! cfg.averaged() ) {
+    cur.errors.clear();
+    cur.count = 1;
+    pointAcquired();
+    return;
+  }
+
+  for (int i = 0 ; i < dets.size() ; i++) {
+    bool ok;
+    const double val = cur.values[i].toDouble(&ok);
+    if ( ok  &&  ! isnan(val) ) {
+      expCount[i]++;
+      expSum[i] += val;
+      expSumSq[i] += val * val;
+    }
+  }
+
+  if ( exposure < cfg.exposures  &&  ! precise() ) {
+    trigger(false, pointRequest(cur.xpoint, cur.ypoint));
+    if ( acquired() ) // nothing to wait for
+      QMetaObject::invokeMethod(this, "advance", Qt::QueuedConnection);
+    return;
+  }
+
+  // non-numeric signals keep the latest reading
+  cur.errors.resize(dets.size());
+  for (int i = 0 ; i < dets.size() ; i++) {
+    const int cnt = expCount[i];
+    if (cnt)
+      cur.values[i] = QString::number(expSum[i] / cnt, 'g', 17);
+    cur.errors[i] = cnt > 1
+        ?  sqrt( qMax(0.0, ( expSumSq[i] - expSum[i] * expSum[i] / cnt ) / (cnt - 1) ) )
+        :  NAN;
+  }
+  cur.count = exposure;
+  pointAcquired();
+
+}
+
+
+/// The standard error of the mean is below ScanConfig::targetError of
+/// the mean in all numeric signals.
+bool ScanEngine::precise() const {
+  if ( cfg.targetError <= 0.0  ||  exposure < 2 )
+    return false;
+  for (int i = 0 ; i < dets.size() ; i++) {
+    const int cnt = expCount[i];
+    if ( ! cnt )
+      continue;
+    if ( cnt < 2 )
+      return false;
+    const double mean = expSum[i] / cnt;
+    const double var = qMax(0.0, ( expSumSq[i] - expSum[i] * mean ) / (cnt - 1) );
+    if ( sqrt(var / cnt) > cfg.targetError * qAbs(mean) )
+      return false;
+  }
+  return true;
+}
+
+
+void ScanEngine::pointAcquired() {
+
+  if (refining)
+    profile[refineAt] = signalValue(cur, cfg.adaptiveSignal);
+
+  if ( cfg.pipeline  &&  ! refining  &&  step < lineSize() - 1 ) {
+    moveToPoint( cfg.listed()  ?  order[step+1]
+               : cfg.reversed(ypoint)  ?  cur.xpoint - 1  :  cur.xpoint + 1 );
+    prefetched = true;
+  }
+  record(cur);
+  hold(&ScanEngine::nextStep);
+
+}
+
+
+void ScanEngine::nextStep() {
+  if (refining) {
+    refineNext();
+  } else if ( ++step < lineSize() ) {
+    moveToStep();
+  } else {
+    endLine();
+  }
+}
+
+
+void ScanEngine::endLine() {
+  if ( cfg.isAdaptive()  &&  ! refining ) {
+    refining = true;
+    refineNext();
+  } else {
+    nextRow();
+  }
+}
+
+
+void ScanEngine::nextRow() {
+  if ( ++ypoint < ( cfg.grid2D() ? cfg.yPoints : 1 ) )
+    beginRow();
+  else
+    nextSlice();
+}
+
+
+/// Moves the outer levels up to (not including) _levels_ to their current points.
+void ScanEngine::beginSlice(int levels) {
+
+  ypoint = resumeY;
+  resumeY = 0;
+  cur.slice = slice;
+  if ( outerMotors.isEmpty() ) {
+    beginRow();
+    return;
+  }
+
+  for (int lev = 0 ; lev < outerPoint.size() ; lev++)
+    setPointVariable(outerPointName(lev), outerPoint[lev]);
+
+  outerRelax = 0;
+  for (int lev = 0 ; lev < levels ; lev++) {
+    QList<QCaMotor*> mots;
+    QVector<double> pos;
+    for (int i = 0 ; i < outerMotors.size() ; i++)
+      if ( outerLevel[i] == lev ) {
+        mots << outerMotors[i];
+        pos << positionAt(outerRange[i], outerPoint[lev], cfg.outer[lev].points);
+      }
+    outerRelax = qMax(outerRelax, cfg.outer[lev].relax);
+    moveGroup(mots, pos);
+  }
+
+  state = MOVING_OUTER;
+  QMetaObject::invokeMethod(this, "advance", Qt::QueuedConnection); // levels may have no motors
+
+}
+
+
+/// Steps the outer levels like an odometer: innermost first.
+void ScanEngine::nextSlice() {
+  for (int lev = 0 ; lev < outerPoint.size() ; lev++) {
+    if ( ++outerPoint[lev] < cfg.outer[lev].points ) {
+      slice++;
+      beginSlice(lev + 1);
+      return;
+    }
+    outerPoint[lev] = 0;
+  }
+  finish();
+}
+
+
+/// Continuous scan of the X line.
+///
+/// The X motors are sent once from the start to the end of the line with the
+/// speed chosen to pass one step in ScanConfig::flyTime. While they move the
+/// signals are sampled continuously, each sample tagged with the time and the
+/// motors' readback. When the line is done the samples are binned onto the
+/// X grid: the point collects all samples within half a step around it.
+/// Raw samples are saved next to the data file with the ".fly" suffix.
+void ScanEngine::flyRunup() {
+
+  const int xPoints = cfg.xPoints;
+  const int nmot = xMotors.size();
+  if ( ! nmot  ||  cfg.flyTime <= 0.0  ||  xPoints < 2 ) { // see begin()
+    nextRow();
+    return;
+  }
+
+  // run-up and slow-down outside the scan range
+  flySpeed.resize(nmot);
+  flyFrom.resize(nmot);
+  flyTo.resize(nmot);
+  for (int i = 0 ; i < nmot ; i++) {
+    QCaMotor * mot = xMotors[i];
+    const double step = ( xRange[i].second - xRange[i].first ) / (xPoints - 1);
+    flySpeed[i] = qAbs(step) / cfg.flyTime;
+    const double runup = ( step < 0 ? -1 : 1 ) * ( qAbs(step) / 2 + flySpeed[i] * mot->getAcceleration() );
+    const double lo = mot->getUserLoLimit();
+    const double hi = mot->getUserHiLimit();
+    flyFrom[i] = qBound(lo, xRange[i].first - runup, hi);
+    flyTo[i] = qBound(lo, xRange[i].second + runup, hi);
+  }
+
+  if ( cfg.reversed(ypoint) )
+    qSwap(flyFrom, flyTo);
+
+  state = FLY_RUNUP;
+  moveGroup(xMotors, flyFrom);
+
+}
+
+
+void ScanEngine::flyStart() {
+
+  const int nmot = xMotors.size();
+  flyNormalSpeed.resize(nmot);
+  for (int i = 0 ; i < nmot ; i++) {
+    flyNormalSpeed[i] = xMotors[i]->getNormalSpeed();
+    xMotors[i]->setNormalSpeed(flySpeed[i]);
+  }
+
+  sampleTime.clear();
+  samplePositions.clear();
+  sampleValues.clear();
+  sampling = false;
+
+  state = FLYING;
+  for (int i = 0 ; i < nmot ; i++)
+    go(xMotors[i], flyTo[i]);
+  flyClock.start();
+  timer.setSingleShot(false);
+  timer.start( qMax(1, int( 1000 * cfg.flyTime / flySamplesPerPoint )) );
+  startSample();
+
+}
+
+
+void ScanEngine::startSample() {
+  sampling = true;
+  sampleStart = flyClock.elapsed();
+  samplePos.resize(xMotors.size());
+  for (int i = 0 ; i < xMotors.size() ; i++)
+    samplePos[i] = xMotors[i]->getUserPosition();
+  trigger(true, pointRequest(-1, ypoint));
+  if ( acquired() )
+    storeSample();
+}
+
+
+void ScanEngine::storeSample() {
+
+  const int nmot = xMotors.size();
+  const int nsig = dets.size();
+  QVector<double> pos(nmot), val(nsig);
+  for (int i = 0 ; i < nmot ; i++)
+    pos[i] = ( samplePos[i] + xMotors[i]->getUserPosition() ) / 2;
+  for (int i = 0 ; i < nsig ; i++) {
+    bool ok;
+    val[i] = dets[i]->value().toDouble(&ok);
+    if ( ! ok )
+      val[i] = NAN;
+  }
+  const double tm = 0.0005 * ( sampleStart + flyClock.elapsed() );
+
+  sampleTime << tm;
+  samplePositions << pos;
+  sampleValues << val;
+  if (flyRaw) {
+    flyStr << ypoint << " " << QString::number(tm, 'g', 17) << " ";
+    foreach (double vl, pos + val)
+      flyStr << QString::number(vl, 'g', 17) << " ";
+    flyStr << "\n";
+    pass(flyWriter, flyStr, flyBuf, 1);
+  }
+  sampling = false;
+
+}
+
+
+void ScanEngine::restoreFlySpeeds() {
+  for (int i = 0 ; i < flyNormalSpeed.size() && i < xMotors.size() ; i++)
+    xMotors[i]->setNormalSpeed(flyNormalSpeed[i]);
+  flyNormalSpeed.clear();
+}
+
+
+/// Bins the samples of the fly line onto the grid of the first X motor.
+void ScanEngine::flyEnd() {
+
+  timer.stop();
+  timer.setSingleShot(true);
+  restoreFlySpeeds();
+
+  const int xPoints = cfg.xPoints;
+  const int nmot = xMotors.size();
+  const int nsig = dets.size();
+  QVector<int> count(xPoints, 0);
+  QVector< QVector<double> > posSum(xPoints, QVector<double>(nmot, 0.0));
+  QVector< QVector<double> > valSum(xPoints, QVector<double>(nsig, 0.0));
+  const double width = xRange[0].second - xRange[0].first;
+  for (int smp = 0 ; smp < sampleTime.size() ; smp++) {
+    const int bin = width == 0.0  ||  xPoints < 2  ?  0  // see begin()
+        : qRound( (xPoints - 1) * ( samplePositions[smp][0] - xRange[0].first ) / width );
+    if ( bin < 0  ||  bin >= xPoints )
+      continue;
+    count[bin]++;
+    for (int i = 0 ; i < nmot ; i++)
+      posSum[bin][i] += samplePositions[smp][i];
+    for (int i = 0 ; i < nsig ; i++)
+      valSum[bin][i] += sampleValues[smp][i];
+  }
+
+  for (int stp = 0 ; stp < xPoints ; stp++) {
+    const int xpoint = cfg.reversed(ypoint)  ?  xPoints - 1 - stp  :  stp;
+    const int cnt = count[xpoint];
+    cur.xpoint = xpoint;
+    cur.ypoint = ypoint;
+    cur.xPos.resize(nmot);
+    for (int i = 0 ; i < nmot ; i++)
+      cur.xPos[i] = cnt  ?  posSum[xpoint][i] / cnt  :  positionAt(xRange[i], xpoint, xPoints);
+    cur.values.clear();
+    for (int i = 0 ; i < nsig ; i++)
+      cur.values << QString::number( cnt  ?  valSum[xpoint][i] / cnt  :  NAN, 'g', 17 );
+    record(cur);
+  }
+
+  hold(&ScanEngine::nextRow);
+
+}
+
+
+/// The line sent to persistent scripts, e.g. "XPOINT=3 YPOINT=7".
+/// Can be evaluated by the shell as it is.
+QString ScanEngine::pointRequest(int xpoint, int ypoint) const {
+  QStringList req;
+  if ( xpoint >= 0 )
+    req << "XPOINT=" + QString::number(xpoint);
+  if ( cfg.grid2D() )
+    req << "YPOINT=" + QString::number(ypoint);
+  for (int lev = 0 ; lev < outerPoint.size() ; lev++)
+    req << outerPointName(lev) + "=" + QString::number(outerPoint[lev]);
+  return req.join(" ");
+}
+
+
+/// Adaptive refinement of the 1D scan.
+///
+/// After the coarse pass over the grid the interval between two neighbouring
+/// points with the highest score is split in half. The score is the change
+/// of the selected signal across the interval plus the mean curvature at its
+/// ends, both relative to the full range of the signal. The refinement goes
+/// on until the best score falls below ScanConfig::adaptiveTolerance or the
+/// point budget is spent. New points are recorded in the order of acquisition
+/// with the xpoint beyond the grid.
+bool ScanEngine::pickRefinement() {
+
+  const double minGap = 1.0 / ( (cfg.xPoints - 1) * 1024.0 );
+  const QList<double> ts = profile.keys();
+  const QList<double> vs = profile.values();
+  const int cnt = ts.size();
+
+  double vmin = NAN, vmax = NAN;
+  foreach (double val, vs)
+    if ( ! isnan(val) ) {
+      if ( isnan(vmin) || val < vmin ) vmin = val;
+      if ( isnan(vmax) || val > vmax ) vmax = val;
+    }
+  const double span = vmax - vmin;
+  if ( cnt < 2  ||  isnan(span)  ||  span <= 0.0 ) // flat or no data: nothing to refine
+    return false;
+
+  // deviation from the linear interpolation between the neighbours
+  QVector<double> curv(cnt, 0.0);
+  for (int i = 1 ; i < cnt-1 ; i++) {
+    const double h1 = ts[i] - ts[i-1];
+    const double h2 = ts[i+1] - ts[i];
+    const double d2 = 2 * ( (vs[i+1] - vs[i]) / h2 - (vs[i] - vs[i-1]) / h1 ) / (h1 + h2);
+    curv[i] = qAbs(d2) * h1 * h2 / span;
+  }
+
+  int best = -1;
+  double bestScore = 0;
+  for (int i = 0 ; i < cnt-1 ; i++) {
+    if ( ts[i+1] - ts[i] < 2 * minGap )
+      continue;
+    const double score = qAbs(vs[i+1] - vs[i]) / span + ( curv[i] + curv[i+1] ) / 2;
+    if ( ! isnan(score)  &&  score > bestScore ) {
+      bestScore = score;
+      best = i;
+    }
+  }
+  if ( best < 0  ||  bestScore < cfg.adaptiveTolerance )
+    return false;
+
+  refineAt = ( ts[best] + ts[best+1] ) / 2;
+  return true;
+
+}
+
+
+void ScanEngine::refineNext() {
+  if ( curpoint >= cfg.totalPoints()  ||  ! pickRefinement() ) {
+    nextRow();
+    return;
+  }
+  const int xpoint = curpoint; // beyond the grid
+  setPointVariable("XPOINT", xpoint);
+  cur.xpoint = xpoint;
+  cur.ypoint = 0;
+  state = MOVING_X;
+  QVector<double> pos(xMotors.size());
+  for (int i = 0 ; i < xMotors.size() ; i++)
+    pos[i] = xRange[i].first + refineAt * ( xRange[i].second - xRange[i].first );
+  moveGroup(xMotors, pos);
+}
+
+
+/// Hands the text collected in the _str_ over to the _writer_ thread.
+void ScanEngine::pass(Writer * writer, QTextStream & str, QString & buf, int rows) {
+  str.flush();
+  if ( buf.isEmpty() )
+    return;
+  QMetaObject::invokeMethod(writer, "write", Qt::QueuedConnection,
+                            Q_ARG(QString, buf), Q_ARG(int, rows));
+  buf.clear();
+}
+
+
+void ScanEngine::record(const ScanPoint & _pt) {
+
+  ScanPoint pt = _pt;
+  pt.index = curpoint++;
+  if ( cfg.isAdaptive()  &&  pt.xpoint < cfg.xPoints ) // coarse pass
+    profile[ double(pt.xpoint) / (cfg.xPoints - 1) ] = signalValue(pt, cfg.adaptiveSignal);
+
+  dataStr << pt.index+1 << " ";
+  if ( cfg.listed() )
+    dataStr << pt.xpoint+1 << " ";
+  foreach (double pos, pt.xPos)
+    dataStr << QString::number(pos, 'g', 17) << " ";
+  foreach (double pos, pt.yPos)
+    dataStr << QString::number(pos, 'g', 17) << " ";
+  foreach (double pos, pt.outerPos)
+    dataStr << QString::number(pos, 'g', 17) << " ";
+  foreach (const QString & strval, pt.values)
+    dataStr << strval << " ";
+  if ( cfg.averaged() ) {
+    foreach (double err, pt.errors)
+      dataStr << QString::number(err, 'g', 17) << " ";
+    dataStr << pt.count << " ";
+  }
+  dataStr <<  "\n";
+  pass(dataWriter, dataStr, dataBuf, 1);
+
+  if (binOut) {
+    QVector<double> row;
+    row << pt.index + 1;
+    if ( cfg.listed() )
+      row << pt.xpoint + 1;
+    row << pt.xPos << pt.yPos << pt.outerPos;
+    foreach (const QString & strval, pt.values) {
+      bool ok;
+      const double val = strval.toDouble(&ok);
+      row << ( ok ? val : NAN );
+    }
+    if ( cfg.averaged() )
+      row << pt.errors << pt.count;
+    QMetaObject::invokeMethod(binWriter, "writeRaw", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, QByteArray(reinterpret_cast<const char *>(row.constData()),
+                                                           row.size() * sizeof(double))),
+                              Q_ARG(int, 1));
+  }
+
+  emit pointDone(pt);
+
+}
+
+
+void ScanEngine::finish() {
+
+  timer.stop();
+  timer.setSingleShot(true);
+  closeFiles();
+
+  // after scan positioning
+  restoreSpeeds();
+  state = FINISHING;
+  const QList<QCaMotor*> allMotors = scanMotors();
+  const QVector< QPair<double,double> > allRanges = xRange + yRange + outerRange;
+  const QVector<double> allInit = xInit + yInit + outerInit;
+  QVector<double> startPos(allMotors.size());
+  for (int i = 0 ; i < allMotors.size() ; i++)
+    startPos[i] = allRanges.value(i).first;
+  if ( cfg.listed()  &&  ! order.isEmpty() ) // first point of the scan
+    for (int i = 0 ; i < listPos[order[0]].size() ; i++)
+      startPos[i] = listPos[order[0]][i];
+  for (int i = 0 ; i < allMotors.size() ; i++)
+    if ( cfg.after == "Start position" )
+      go(allMotors[i], startPos[i]);
+    else if ( cfg.after == "Prior position" )
+      go(allMotors[i], allInit.value(i));
+  advance();
+
+}
+
+
+/// Ends the data files and the persistent scripts.
+void ScanEngine::closeFiles() {
+  dataStr << (stopNow.load() ? "# Stopped unfinished" : "# All done") << ".\n";
+  pass(dataWriter, dataStr, dataBuf, 0);
+  // blocking: the files are complete by the time finished() is emitted
+  QMetaObject::invokeMethod(dataWriter, "close", Qt::BlockingQueuedConnection);
+  if (flyRaw)
+    QMetaObject::invokeMethod(flyWriter, "close", Qt::BlockingQueuedConnection);
+  if (binOut)
+    QMetaObject::invokeMethod(binWriter, "close", Qt::BlockingQueuedConnection);
+  binOut = false;
+  flyRaw = false;
+  foreach (Detector * det, dets)
+    det->scr->stopPersistent();
+}
+
+
+void ScanEngine::shutdown() {
+
+  if ( ! isScanning() )
+    return;
+  if ( state == CONNECTING ) { // nothing moved or written yet
+    abort();
+    return;
+  }
+  stopNow.store(1);
+  timer.stop();
+  motionTimer.stop();
+  foreach (Detector * det, dets)
+    det->cancel();
+  foreach (QCaMotor * mot, scanMotors())
+    mot->stop();
+  restoreFlySpeeds();
+  restoreSpeeds();
+  if ( state != FINISHING ) // otherwise already closed
+    closeFiles();
+  complete();
+
+}
+
+
+void ScanEngine::complete() {
+  const bool stopped = stopNow.load();
+  state = IDLE;
+  motion.clear();
+  stopNow.store(0);
+  scanning.store(0);
+  emit finished(stopped);
+}
@@ -0,0 +1,453 @@
+#ifndef SCANENGINE_H
+#define SCANENGINE_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QMap>
+#include <QStringList>
+#include <QVariant>
+#include <QAtomicInt>
+#include <QMetaType>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QSettings>
+#include <qcamotor.h>
+#include <qtpv.h>
+
+#include "script.h"
+
+
+/// One motor taking part in the scan.
+struct ScanAxis {
+  QString pv;
+  double start;
+  double end;
+  bool relative;     ///< start and end are relative to the position prior to the scan.
+  ScanAxis(const QString & _pv = QString(), double _start=0, double _end=0, bool _relative=false)
+    : pv(_pv), start(_start), end(_end), relative(_relative) {}
+};
+
+
+/// Outer level of the N-dimensional scan: the whole X (or X/Y) scan,
+/// the slice, is repeated in each of its points.
+struct ScanLevel {
+  QList<ScanAxis> axes;
+  int points;
+  double relax;           ///< seconds to wait after the move of the level
+  ScanLevel(int _points=1, double _relax=0) : points(_points), relax(_relax) {}
+};
+
+
+/// Everything the ScanEngine needs to know to run the scan.
+/// Plain data: can be filled from the GUI, a configuration file or a script.
+struct ScanConfig {
+  QList<ScanAxis> xAxes;
+  QList<ScanAxis> yAxes;
+  int xPoints;
+  int yPoints;
+  bool scan2D;
+  double relaxY;          ///< seconds to wait after each Y move
+  QString after;          ///< "End position", "Start position" or "Prior position"
+  QStringList signalNames; ///< PVs or scripts
+  QString fileName;       ///< data file; nothing is written if empty
+  bool fly;               ///< X axis is scanned continuously (see ScanEngine::flyRunup)
+  double flyTime;         ///< seconds per X point in the fly mode
+  bool snake;             ///< X direction is reversed in every odd line of the 2D scan
+  bool persistentScripts; ///< scripts are started once per scan (see Script::startPersistent)
+  bool pipeline;          ///< X motors move to the next point while the current one is recorded
+  bool coordinated;       ///< motors of the axis arrive together (see ScanEngine::moveGroup)
+  bool adaptive;          ///< 1D scan is refined after the coarse pass (see ScanEngine::pickRefinement)
+  int adaptivePoints;     ///< total points budget of the adaptive scan
+  double adaptiveTolerance; ///< relative to the signal range
+  int adaptiveSignal;     ///< index in signalNames of the signal driving the refinement
+  QList< QVector<double> > pointList; ///< listed points instead of the grid: X motors, then Y motors
+  QString pointListFile;  ///< where the pointList came from; informative only
+  QList<ScanLevel> outer; ///< outer levels of the N-dimensional scan, innermost first
+  int exposures;          ///< maximum number of readings averaged in each point
+  double targetError;     ///< relative standard error of the mean to stop the readings at; 0 for none
+  int resumeFrom;         ///< points already in the data file of the resumed scan (see ScanEngine::resumeFile)
+  QVector<double> resumeInit; ///< resumed scan: initial positions of the X, Y and outer motors
+  bool textData;          ///< write the text data file fileName
+  bool binaryData;        ///< write the binary data file fileName.bin (see BinaryScan)
+  double flushInterval;   ///< s: the longest the written data waits before it goes to the disk
+  int flushRows;          ///< data lines which go to the disk at once; 0 for no limit
+  ScanConfig() : xPoints(2), yPoints(1), scan2D(false), relaxY(0), after("End position"),
+    fly(false), flyTime(0.1), snake(false), persistentScripts(false), pipeline(false),
+    coordinated(false), adaptive(false), adaptivePoints(50), adaptiveTolerance(0.05), adaptiveSignal(0),
+    exposures(1), targetError(0), resumeFrom(0), textData(true), binaryData(false),
+    flushInterval(1.0), flushRows(100) {}
+  inline bool averaged() const { return exposures > 1 && ! isFly(); }
+  inline int sliceSize() const {
+    return listed()  ?  pointList.size()  :  xPoints * ( grid2D() ? yPoints : 1 );
+  }
+  /// Position of the point number _index_ of the grid scan in the scan order.
+  inline void gridPoint(int index, int & step, int & ypoint, int & slice) const {
+    const int line = listed()  ?  pointList.size()  :  xPoints;
+    slice = index / sliceSize();
+    ypoint = ( index % sliceSize() ) / line;
+    step = index % line;
+  }
+  inline int xpointAt(int step, int ypoint) const {
+    return reversed(ypoint)  ?  xPoints - 1 - step  :  step;
+  }
+  inline bool listed() const { return ! pointList.isEmpty(); }
+  inline bool grid2D() const { return scan2D && ! listed(); }
+  inline bool isFly() const { return fly && ! listed(); }
+  inline bool reversed(int ypoint) const { return grid2D() && snake && ypoint % 2; }
+  inline int slices() const {
+    int cnt = 1;
+    foreach (const ScanLevel & lev, outer)
+      cnt *= qMax(1, lev.points);
+    return cnt;
+  }
+  inline bool isAdaptive() const {
+    return adaptive && ! scan2D && ! fly && ! listed() && outer.isEmpty()
+        && adaptiveSignal >= 0 && adaptiveSignal < signalNames.size();
+  }
+  inline int totalPoints() const {
+    if ( listed() )
+      return pointList.size() * slices();
+    if ( isAdaptive() )
+      return qMax(xPoints, adaptivePoints);
+    return xPoints * ( scan2D ? yPoints : 1 ) * slices();
+  }
+};
+
+
+/// The result of the acquisition in a single point of the scan.
+struct ScanPoint {
+  int index;               ///< sequential number of the point in the scan
+  int xpoint;
+  int ypoint;              ///< xpoint and ypoint: grid position, independent of the scan order
+  int slice;               ///< sequential number of the outer levels point
+  QVector<double> xPos;    ///< readback positions of the X motors
+  QVector<double> yPos;    ///< readback positions of the Y motors
+  QVector<double> outerPos; ///< readback positions of the motors of the outer levels
+  QStringList values;      ///< one per signal, in the order of ScanConfig::signalNames
+  QVector<double> errors;  ///< averaged point: standard deviation of each signal
+  int count;               ///< averaged point: number of readings
+  ScanPoint() : index(-1), xpoint(-1), ypoint(-1), slice(0), count(1) {}
+};
+
+/// Timings the duration of the scan is estimated from (see ScanEngine::estimate).
+struct ScanTimings {
+  QHash<QString,double> speed;        ///< motor PV: normal speed
+  QHash<QString,double> acceleration; ///< motor PV: acceleration time, s
+  QHash<QString,double> signalTime;   ///< signal name: time it takes to read, s
+};
+
+Q_DECLARE_METATYPE(ScanAxis)
+Q_DECLARE_METATYPE(ScanLevel)
+Q_DECLARE_METATYPE(ScanConfig)
+Q_DECLARE_METATYPE(ScanPoint)
+
+
+
+/// Runs the scan: moves the motors, reads the signals and writes the data file.
+///
+/// The engine does not depend on any widget. It owns its own motors and
+/// signal readers (cached between the scans by the PV / script name) and is
+/// meant to live in a worker thread. All results are reported via signals
+/// which are delivered to the GUI thread as queued connections.
+///
+/// The scan is an explicit state machine (move -> settle -> trigger -> read
+/// -> record) advanced by the motor-done, timer and signal-done events. Nothing
+/// blocks or spins a nested event loop, so the stop is served immediately.
+class ScanEngine : public QObject {
+  Q_OBJECT;
+
+public:
+
+  explicit ScanEngine(QObject * parent = 0);
+  ~ScanEngine();
+
+  bool isScanning() const { return scanning.load(); }
+
+  /// Registers the meta types needed to pass the scan data across threads.
+  static void registerMetaTypes();
+
+  /// Reads the positions of the point list scan (see ScanConfig::pointList).
+  static bool readPointList(const QString & fileName, QList< QVector<double> > & points);
+
+  /// Reads the scan from the _settings_ stored by the GUI (all but the file name).
+  /// The point list is read from its file only with _readList_.
+  /// Returns the problem if there is one.
+  static QString readConfig(QSettings & settings, ScanConfig & cfg, bool readList = true);
+
+  /// Prepares _cfg_ to continue the interrupted scan in the data file.
+  /// The points already there are returned in _done_.
+  /// Returns the reason if the file does not match the configuration.
+  static QString resumeFile(const QString & fileName, ScanConfig & cfg, QList<ScanPoint> & done);
+
+  /// Expected duration of the scan in seconds, not counting the moves to
+  /// the start and after the scan.
+  static double estimate(const ScanConfig & cfg, const ScanTimings & timings);
+
+public slots:
+
+  void start(const ScanConfig & cfg);
+  void stop();        ///< thread safe: can be called from any thread
+  void pause();       ///< holds the scan after the current point
+  void resume();
+  /// Stops the motors and closes the files at once, without waiting for the
+  /// motors to halt and without the after-scan positioning. For the exit:
+  /// call it blocking from another thread.
+  void shutdown();
+
+private slots:
+
+  void onStop();
+  void onMotorMoving(bool moving);
+  void onMotionStartTimeout();
+  void onTimer();
+  void advance();
+
+private:
+
+  class Detector;
+
+  enum State {
+    IDLE,
+    CONNECTING,   ///< waiting for the PVs to connect
+    MOVING_OUTER,
+    SETTLING_OUTER, ///< relaxation after the move of the outer levels
+    MOVING_Y,
+    SETTLING_Y,   ///< relaxation after the Y move
+    MOVING_X,
+    ACQUIRING,    ///< signals triggered, waiting for all of them
+    FLY_RUNUP,    ///< moving to the start of the fly line
+    FLYING,
+    PAUSED,
+    STOPPING,     ///< stop requested, waiting for the motors to halt
+    FINISHING     ///< after-scan positioning
+  };
+
+  enum Motion {
+    ARRIVED=0,
+    COMMANDED,    ///< move requested, not seen moving yet
+    MOVING
+  };
+
+  ScanConfig cfg;
+  QAtomicInt scanning;
+  QAtomicInt stopNow;
+  State state;
+  bool pausing;
+
+  typedef void (ScanEngine::*Continuation)();
+  Continuation proceed; ///< what to do on resume()
+  void hold(Continuation next);
+
+  QHash<QString, QCaMotor*> motors;
+  QHash<QString, Detector*> detectors;
+  QHash<QCaMotor*, Motion> motion;
+  QHash<QCaMotor*, double> normalSpeed; ///< speeds prior to the coordinated moves
+
+  QCaMotor * motor(const QString & pv);
+  Detector * detector(const QString & name);
+
+  static const int connectionTimeout; ///< ms
+  static const int motionStartTimeout; ///< ms
+  static const int flySamplesPerPoint;
+  static const int orderingTime; ///< ms, budget of the 2-opt ordering of the point list
+
+  QTimer timer;       ///< connection timeout, settling and fly sampling period
+  QTimer motionTimer; ///< motion start fallback (see onMotionStartTimeout)
+
+  // State of the current scan.
+  QList<QCaMotor*> xMotors;
+  QList<QCaMotor*> yMotors;
+  QList<Detector*> dets;
+  QVector<double> xInit;
+  QVector<double> yInit;
+  QVector< QPair<double,double> > xRange;
+  QVector< QPair<double,double> > yRange;
+  QList<QCaMotor*> outerMotors; ///< all outer levels
+  QVector<int> outerLevel;      ///< level of each of the outerMotors
+  QVector<double> outerInit;
+  QVector< QPair<double,double> > outerRange;
+  QVector<int> outerPoint;      ///< current point of each outer level
+  int slice;
+  double outerRelax;            ///< seconds, the longest of the levels just moved
+  int curpoint;
+  int ypoint;
+  int step;           ///< X point in the order of the scan
+  bool prefetched;    ///< pipelined scan: the motors are already on the way to the step
+  int resumeY;        ///< resumed scan: first row ...
+  int resumeStep;     ///< ... and point in it
+  QVector< QVector<double> > listPos; ///< point list scan: absolute positions of all motors
+  QVector<int> order; ///< point list scan: indexes of the listed points in the order of the scan
+  ScanPoint cur;
+  bool refining;
+  double refineAt;    ///< position along the line (0..1) of the refinement point
+  QMap<double,double> profile; ///< adaptive scan: signal vs position along the line (0..1)
+  int exposure;       ///< readings done in the current point
+  QVector<int> expCount; ///< numeric readings of each signal
+  QVector<double> expSum;
+  QVector<double> expSumSq;
+
+  // Files: the text is collected in the strings and passed to the writers.
+  class Writer;
+  QThread writerThread;
+  Writer * dataWriter;
+  Writer * flyWriter;
+  Writer * binWriter;
+  bool binOut;        ///< the binary data file is written
+  QString dataBuf;
+  QTextStream dataStr;
+  QString flyBuf;
+  QTextStream flyStr;
+  bool flyRaw;        ///< raw samples of the fly scan are saved
+  void pass(Writer * writer, QTextStream & str, QString & buf, int rows);
+
+  // Fly line.
+  QVector<double> flySpeed;
+  QVector<double> flyNormalSpeed;
+  QVector<double> flyFrom;
+  QVector<double> flyTo;
+  QElapsedTimer flyClock;
+  bool sampling;
+  qint64 sampleStart;
+  QVector<double> samplePos;
+  QVector<double> sampleTime;
+  QVector< QVector<double> > samplePositions;
+  QVector< QVector<double> > sampleValues;
+
+  void go(QCaMotor * mot, double pos);
+  void moveGroup(const QList<QCaMotor*> & mots, const QVector<double> & pos);
+  void restoreSpeeds();
+  void setPointVariable(const QString & name, int value);
+  bool arrived(const QList<QCaMotor*> & mots) const;
+  bool connected() const;
+  QList<QCaMotor*> scanMotors() const;
+  void readPositions(const QList<QCaMotor*> & mots, QVector<double> & pos, const QString & axis);
+
+  void prepare();
+  void begin();
+  void abort();
+  void writeHeader();
+  void resumeHeader();
+  QStringList binaryColumns() const;
+  void beginSlice(int levels);
+  void nextSlice();
+  void beginRow();
+  void beginLine();
+  void moveToStep();
+  void moveToPoint(int xpoint);
+  int lineSize() const;
+  void orderPoints();
+  void trigger(bool latest, const QString & request);
+  bool acquired() const;
+  QStringList collect() const;
+  void exposureDone();
+  bool precise() const;
+  void pointAcquired();
+  void nextStep();
+  void endLine();
+  void nextRow();
+  void refineNext();
+  bool pickRefinement();
+  void flyRunup();
+  void flyStart();
+  void startSample();
+  void storeSample();
+  void flyEnd();
+  void restoreFlySpeeds();
+  QString pointRequest(int xpoint, int ypoint) const;
+  void record(const ScanPoint & pt);
+  void finish();
+  void closeFiles();
+  void complete();
+
+signals:
+
+  void started(int totalPoints);
+  void pointDone(const ScanPoint & point);
+  void finished(bool stopped);
+  void paused(bool on);
+  void signalTimed(const QString & name, double seconds); ///< time the signal took to read
+
+};
+
+
+
+/// Reader of a single signal: PV or script.
+class ScanEngine::Detector : public QObject {
+  Q_OBJECT;
+
+public:
+
+  QEpicsPv * pv;
+  Script * scr;
+  bool fresh; ///< just created: PV may be not connected yet
+
+  Detector(const QString & name, QObject * parent=0);
+
+  void trigger(bool latest=false, const QString & request=QString());
+  void cancel();
+  inline bool isDone() const { return mode == IDLE; }
+  inline const QVariant & value() const { return val; }
+  inline double readTime() const { return took; } ///< s; negative if not measured
+
+private:
+
+  enum Mode { IDLE, UPDATE, STARTED, ASKED };
+  Mode mode;
+  QVariant val;
+  QElapsedTimer clock;
+  double took;
+  QTimer updateTimer;
+
+  static const int updateTimeout; ///< ms
+
+private slots:
+
+  void onUpdated();
+  void onFinished();
+  void onAnswered();
+
+signals:
+
+  void done();
+
+};
+
+
+/// Writes a file in its own thread so that the disk never holds the scan.
+///
+/// The text comes in the queued write() calls and goes to the disk when
+/// ScanConfig::flushRows lines are collected or ScanConfig::flushInterval
+/// passes, whichever comes first: a crash loses at most that much.
+class ScanEngine::Writer : public QObject {
+  Q_OBJECT;
+
+public:
+
+  explicit Writer(QObject * parent=0);
+
+private:
+
+  QFile file;
+  QTextStream str;
+  QTimer flushTimer;
+  int pending;        ///< lines not flushed yet
+  int flushRows;
+
+public slots:
+
+  void open(const QString & fileName, bool append, double flushInterval, int flushRows);
+  void write(const QString & text, int rows);
+  void writeRaw(const QByteArray & bytes, int rows);
+  void flush();
+  void close();
+
+};
+
+
+#endif // SCANENGINE_H
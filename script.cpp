@@ -13,10 +13,13 @@ Script::Script(QObject *parent) :
   QObject(parent),
   pth(),
   proc(this),
-  fileExec(this)
+  fileExec(this),
+  persistent(false),
+  pending(false)
 {
   connect(&proc, SIGNAL(stateChanged(QProcess::ProcessState)),
           SLOT(onState(QProcess::ProcessState)));
+  connect(&proc, SIGNAL(readyReadStandardOutput()), SLOT(onReadyRead()));
   if ( ! fileExec.open() )
     qDebug() << "ERROR! Unable to open temporary file.";
 }
@@ -53,13 +56,75 @@ int Script::evaluate() {
 }
 
 
+/// Inherited one with the variables; empty (also inherited) if there are none.
+QProcessEnvironment Script::environment() const {
+  if ( vars.isEmpty() )
+    return QProcessEnvironment();
+  QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+  QHash<QString,QString>::const_iterator it;
+  for ( it = vars.constBegin() ; it != vars.constEnd() ; ++it )
+    env.insert(it.key(), it.value());
+  return env;
+}
+
+
 bool Script::start() {
   if ( ! fileExec.isOpen() || isRunning() || pth.isEmpty() )
     return false;
+  persistent = false;
+  proc.setProcessEnvironment(environment());
   proc.start("/bin/sh " + fileExec.fileName());
   return isRunning();
 }
 
+
+bool Script::startPersistent() {
+  if ( ! fileExec.isOpen() || isRunning() || pth.isEmpty() )
+    return false;
+  persistent = true;
+  pending = false;
+  QProcessEnvironment env = environment();
+  env.insert("SCANMX_PERSISTENT", "1");
+  proc.setProcessEnvironment(env);
+  proc.start("/bin/sh " + fileExec.fileName());
+  if ( ! proc.waitForStarted() )
+    persistent = false;
+  return isPersistent();
+}
+
+
+bool Script::request(const QString & line) {
+  if ( ! isPersistent() )
+    return false;
+  proc.readAllStandardOutput(); // drop whatever was not requested
+  pending = true;
+  proc.write( (line + "\n").toLatin1() );
+  return true;
+}
+
+
+void Script::stopPersistent() {
+  if ( ! isPersistent() )
+    return;
+  proc.closeWriteChannel(); // script gets EOF on its stdin
+  if ( ! proc.waitForFinished(1000) )
+    proc.kill();
+}
+
+
+void Script::onReadyRead() {
+  if ( ! persistent )
+    return;
+  while ( pending && proc.canReadLine() ) {
+    lastOut = proc.readLine();
+    if( lastOut.size() && lastOut.at(lastOut.size()-1) == '\n' )
+      lastOut.chop(1);
+    pending = false;
+    emit answered();
+    emit outChanged( lastOut );
+  }
+}
+
 int Script::waitStop() {
   QEventLoop q;
   connect(&proc, SIGNAL(finished(int)), &q, SLOT(quit()));
@@ -69,7 +134,12 @@ int Script::waitStop() {
 }
 
 void Script::onState(QProcess::ProcessState state) {
-  if (state==QProcess::NotRunning) {
+  if (state==QProcess::NotRunning && persistent) {
+    persistent = false;
+    pending = false;
+    lastErr = proc.readAllStandardError();
+    emit finished(proc.exitCode());
+  } else if (state==QProcess::NotRunning) {
     lastErr = proc.readAllStandardError();
     if( lastErr.size() && lastErr.at(lastErr.size()-1) == '\n' )
       lastErr.chop(1);
@@ -3,6 +3,7 @@
 
 #include <QProcess>
 #include <QTemporaryFile>
+#include <QHash>
 
 
 class Script : public QObject {
@@ -14,6 +15,10 @@ private:
   QString lastErr;
   QProcess proc;
   QTemporaryFile fileExec;
+  bool persistent;
+  bool pending;
+  QHash<QString,QString> vars; ///< added to the environment of the script
+  QProcessEnvironment environment() const;
 
 public:
   explicit Script(QObject *parent = 0);
@@ -25,6 +30,18 @@ public:
   bool isRunning() const { return proc.pid(); };
   const QString path() const;
 
+  // Variables passed to the script process only: the environment of the
+  // application itself is never changed (other threads may read it).
+  void setVariable(const QString & name, const QString & value) { vars[name] = value; }
+  void clearVariables() { vars.clear(); }
+
+  // Persistent mode: the script is started once and fed the requests
+  // line by line on its stdin; it answers one line per request.
+  bool startPersistent();
+  bool isPersistent() const { return persistent && isRunning(); }
+  bool request(const QString & line);
+  void stopPersistent();
+
 public slots:
   bool start();
   int execute() { return start() ? waitStop() : -1 ; };
@@ -34,6 +51,7 @@ private slots:
   int evaluate();
   void onState(QProcess::ProcessState state);
   void onStartStop() { if (isRunning()) stop(); else start(); };
+  void onReadyRead();
 
 signals:
 
@@ -41,6 +59,7 @@ signals:
   void finished(int status);
   void started();
   void outChanged(const QString & out);
+  void answered();
 
 };
 